@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stub of the afb-daemon interface for running bindings in benchmarks
+ *
+ * To be included after the source of the binding. It provides:
+ *
+ *  - a binding interface whose events serialize the pushed objects
+ *    like the daemon does for each of its transports
+ *  - requests made of a JSON object of arguments whose replies are
+ *    recorded
+ *
+ * Call 'stub_init' before using the binding.
+ */
+
+#include <time.h>
+
+/*
+ * counters of the stub
+ */
+static struct {
+	int transports;		/* count of serializations by push */
+	int listeners;		/* count of listeners of each event */
+	uint64_t pushes;	/* count of events pushed */
+	uint64_t serializations; /* count of serializations of pushed objects */
+	uint64_t bytes;		/* count of bytes serialized */
+	int format;		/* if not zero, serializations format the objects again */
+	const char *status;	/* status of the last reply */
+	struct json_object *reply; /* object of the last reply */
+	void (*on_push)();	/* if not NULL, called after each push */
+} stub = {
+	.transports = 1,
+	.listeners = 1
+};
+
+/*
+ * event interface: pushing serializes the object for each transport
+ */
+static int stub_event_push(void *closure, struct json_object *obj)
+{
+	int i;
+
+	stub.pushes++;
+	if (stub.format)
+		/* restores the default serializer, formatting at each call */
+		json_object_set_serializer(obj, NULL, NULL, NULL);
+	for (i = 0 ; i < stub.transports ; i++) {
+		stub.bytes += strlen(json_object_to_json_string(obj));
+		stub.serializations++;
+	}
+	json_object_put(obj);
+	if (stub.on_push != NULL)
+		stub.on_push();
+	return stub.listeners;
+}
+
+static int stub_event_broadcast(void *closure, struct json_object *obj)
+{
+	json_object_put(obj);
+	return 0;
+}
+
+static void stub_event_drop(void *closure)
+{
+}
+
+static const struct afb_event_itf stub_event_itf = {
+	.broadcast = stub_event_broadcast,
+	.push = stub_event_push,
+	.drop = stub_event_drop
+};
+
+/*
+ * daemon interface
+ */
+static struct sd_event *stub_loop;
+
+static struct sd_event *stub_get_event_loop(void *closure)
+{
+	return stub_loop;
+}
+
+static void stub_vverbose(void *closure, int level, const char *file, int line, const char *fmt, va_list args)
+{
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+}
+
+static struct afb_event stub_event_make(void *closure, const char *name)
+{
+	return (struct afb_event){ .itf = &stub_event_itf, .closure = (void*)name };
+}
+
+static const struct afb_daemon_itf stub_daemon_itf = {
+	.get_event_loop = stub_get_event_loop,
+	.vverbose = stub_vverbose,
+	.event_make = stub_event_make
+};
+
+static const struct afb_binding_interface stub_interface = {
+	.daemon = { .itf = &stub_daemon_itf, .closure = NULL },
+	.verbosity = 0
+};
+
+/*
+ * request interface: the closure is the JSON object of the arguments
+ */
+static struct json_object *stub_req_json(void *closure)
+{
+	return closure;
+}
+
+static struct afb_arg stub_req_get(void *closure, const char *name)
+{
+	struct json_object *value;
+	struct afb_arg arg = { .name = name };
+
+	if (json_object_object_get_ex(closure, name, &value))
+		arg.value = json_object_get_string(value);
+	return arg;
+}
+
+static void stub_req_success(void *closure, struct json_object *obj, const char *info)
+{
+	json_object_put(stub.reply);
+	stub.reply = obj;
+	stub.status = "success";
+}
+
+static void stub_req_fail(void *closure, const char *status, const char *info)
+{
+	json_object_put(stub.reply);
+	stub.reply = NULL;
+	stub.status = status;
+}
+
+static int stub_req_subscribe(void *closure, struct afb_event event)
+{
+	return 0;
+}
+
+static int stub_req_unsubscribe(void *closure, struct afb_event event)
+{
+	return 0;
+}
+
+static const struct afb_req_itf stub_req_itf = {
+	.json = stub_req_json,
+	.get = stub_req_get,
+	.success = stub_req_success,
+	.fail = stub_req_fail,
+	.subscribe = stub_req_subscribe,
+	.unsubscribe = stub_req_unsubscribe
+};
+
+/*
+ * makes a request whose arguments are the JSON object 'args'
+ * (the object is not released)
+ */
+static struct afb_req stub_req(struct json_object *args)
+{
+	return (struct afb_req){ .itf = &stub_req_itf, .closure = args };
+}
+
+/*
+ * initialises the stub and registers the binding
+ */
+static int stub_init()
+{
+	if (sd_event_default(&stub_loop) < 0)
+		return -1;
+	afbBindingV1Register(&stub_interface);
+	return 0;
+}
+
+/*
+ * returns the current time in nanoseconds
+ */
+static uint64_t stub_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
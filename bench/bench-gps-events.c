@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the events of the GPS binding
+ *
+ * Subscribers are spread over the types and the periods, a 10 Hz
+ * stream of frames is simulated and the events are pushed to a stub
+ * daemon that serializes them for each of its transports.
+ *
+ * The frames are simulated twice: before, the daemon formatting the
+ * positions at each serialization as it did when they weren't rendered
+ * (their rendering, then dropped, still being done), then after, the
+ * positions being rendered once per frame and type.
+ * It reports for both the counts per frame of serializations requested
+ * by the daemon and of positions actually formatted, and the time.
+ *
+ * usage: bench-gps-events [SUBSCRIBERS [TRANSPORTS [FRAMES]]]
+ */
+
+#include "../binding/af-gps-binding.c"
+#include "afb-stub.h"
+
+/*
+ * the sentences of one frame, the time being set for each frame
+ */
+static const char rmc[] = "$GPRMC,%02d%02d%02d.%d00,A,4807.0381,N,01131.0002,E,12.41,84.40,280516,,,A";
+static const char gga[] = "$GPGGA,%02d%02d%02d.%d00,4807.0381,N,01131.0002,E,1,09,0.9,545.4,M,46.9,M,,";
+
+/*
+ * appends to the ring of the source the sentence of format 'fmt' for 'frame'
+ */
+static void put_sentence(struct source *src, const char *fmt, int frame)
+{
+	char buffer[NMEA_MAX_LENGTH];
+	int len, i, sum;
+	int t = frame / 10;
+
+	len = snprintf(buffer, sizeof buffer - 5, fmt, t / 3600 % 24, t / 60 % 60, t % 60, frame % 10);
+	for (sum = 0, i = 1 ; i < len ; i++)
+		sum ^= buffer[i];
+	len += snprintf(&buffer[len], 6, "*%02X\r\n", sum);
+	memcpy(&src->ring.base[src->ring.head & src->ring.mask], buffer, (size_t)len);
+	src->ring.head += (uint32_t)len;
+}
+
+/*
+ * measures of a run
+ */
+struct measure {
+	uint64_t pushes;
+	uint64_t serializations;
+	uint64_t formats;
+	uint64_t bytes;
+	uint64_t duration;
+};
+
+/*
+ * simulates 'frames' frames at 10 Hz from the time 't' in us for the
+ * subscribers of 'src', the daemon formatting again at each
+ * serialization if 'format'
+ */
+static void run(struct source *src, int frames, int format, uint64_t *t, struct measure *m)
+{
+	int i;
+	uint64_t start, pushes, serializations, bytes, renders;
+
+	stub.format = format;
+	pushes = stub.pushes;
+	serializations = stub.serializations;
+	bytes = stub.bytes;
+	renders = src->renders;
+	start = stub_now_ns();
+	for (i = 0 ; i < frames ; i++) {
+		put_sentence(src, rmc, i);
+		put_sentence(src, gga, i);
+		ring_scan(src);
+		*t += 100000;
+		on_timer(NULL, *t, NULL);
+	}
+	m->duration = stub_now_ns() - start;
+	m->pushes = stub.pushes - pushes;
+	m->serializations = stub.serializations - serializations;
+	m->bytes = stub.bytes - bytes;
+	m->formats = format ? m->serializations : src->renders - renders;
+}
+
+int main(int ac, char **av)
+{
+	int subscribers, frames, i, events;
+	struct source *src;
+	struct json_object *args;
+	struct period *p;
+	struct event *e;
+	struct measure before, after;
+	uint64_t t;
+	char period[20];
+
+	subscribers = ac > 1 ? atoi(av[1]) : 128;
+	stub.transports = ac > 2 ? atoi(av[2]) : 2;
+	frames = ac > 3 ? atoi(av[3]) : 10000;
+
+	if (stub_init() < 0) {
+		fprintf(stderr, "can't initialise the stub\n");
+		return 1;
+	}
+	nmea_scan_init();
+	setenv("AFBGPS_SOURCES", "bench=nmea://localhost:0", 1);
+	if (sources_init() < 0) {
+		fprintf(stderr, "can't create the source\n");
+		return 1;
+	}
+	src = list_of_sources;
+
+	/* subscribes spreading the types and the periods */
+	for (i = 0 ; i < subscribers ; i++) {
+		snprintf(period, sizeof period, "%d", 100 * (1 + (i / type_COUNT) % 31));
+		args = json_object_new_object();
+		json_object_object_add(args, "type", json_object_new_string(type_NAMES[i % type_COUNT]));
+		json_object_object_add(args, "period", json_object_new_string(period));
+		subscribe(stub_req(args));
+		json_object_put(args);
+	}
+	for (events = 0, p = src->periods ; p != NULL ; p = p->next)
+		for (e = p->events ; e != NULL ; e = e->next)
+			events++;
+
+	/* simulates the frames formatting at each serialization, then rendering once */
+	t = now_us();
+	run(src, frames, 1, &t, &before);
+	run(src, frames, 0, &t, &after);
+
+	printf("subscribers %d, events %d, transports %d, frames %d\n", subscribers, events, stub.transports, frames);
+	printf("                                    before      after\n");
+	printf("events pushed per frame:        %10.2f %10.2f\n", (double)before.pushes / frames, (double)after.pushes / frames);
+	printf("serializations per frame:       %10.2f %10.2f\n", (double)before.serializations / frames, (double)after.serializations / frames);
+	printf("positions formatted per frame:  %10.2f %10.2f\n", (double)before.formats / frames, (double)after.formats / frames);
+	printf("bytes serialized per frame:     %10.2f %10.2f\n", (double)before.bytes / frames, (double)after.bytes / frames);
+	printf("time per frame (us):            %10.2f %10.2f\n", (double)before.duration / frames / 1000, (double)after.duration / frames / 1000);
+	printf("rendered positions pooled:      %10u (slabs %u)\n", render_pool.live + render_pool.idle, render_pool.slabs);
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the ingestion of the GPS binding
+ *
+ * For each count of subscribers, frames of RMC and GGA sentences are
+ * put in the ring of a source, scanned and fanned out to subscribers
+ * of events sent on every fix, spread over the types. The events are
+ * pushed to the stub daemon that serializes them.
+ *
+ * It reports for each count:
+ *
+ *  - the sentences per second and the time per sentence of the scan
+ *  - the allocations per frame of the whole processing
+ *  - the median and the 99th percentile of the latency of the events,
+ *    from the start of the scan of the frame to the end of the push
+ *
+ * usage: bench-gps-ingest [FRAMES [SUBSCRIBERS...]]
+ */
+
+#include "../binding/af-gps-binding.c"
+#include "afb-stub.h"
+
+/*
+ * counting of the allocations, overriding the ones of the C library
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocations;
+
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	allocations++;
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+/*
+ * the sentences of one frame, the time being set for each frame
+ */
+static const char rmc[] = "$GPRMC,%02d%02d%02d.%d00,A,4807.0381,N,01131.0002,E,12.41,84.40,280516,,,A";
+static const char gga[] = "$GPGGA,%02d%02d%02d.%d00,4807.0381,N,01131.0002,E,1,09,0.9,545.4,M,46.9,M,,";
+#define SENTENCES_BY_FRAME	2
+
+/*
+ * latencies of the events of the current measure
+ */
+static uint32_t *latencies;
+static size_t latency_count;
+static size_t latency_max;
+static uint64_t frame_start;
+
+static void on_push()
+{
+	if (latency_count < latency_max)
+		latencies[latency_count++] = (uint32_t)(stub_now_ns() - frame_start);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * appends to the ring of the source the sentence of format 'fmt' for 'frame'
+ */
+static void put_sentence(struct source *src, const char *fmt, int frame)
+{
+	char buffer[NMEA_MAX_LENGTH];
+	int len, i, sum;
+	int t = frame / 10;
+
+	len = snprintf(buffer, sizeof buffer - 5, fmt, t / 3600 % 24, t / 60 % 60, t % 60, frame % 10);
+	for (sum = 0, i = 1 ; i < len ; i++)
+		sum ^= buffer[i];
+	len += snprintf(&buffer[len], 6, "*%02X\r\n", sum);
+	memcpy(&src->ring.base[src->ring.head & src->ring.mask], buffer, (size_t)len);
+	src->ring.head += (uint32_t)len;
+}
+
+/*
+ * measures 'frames' frames for 'subscribers' subscribers of 'src'
+ */
+static void measure(struct source *src, int frames, int subscribers)
+{
+	int i;
+	uint64_t t, tscan = 0, allocs;
+	struct json_object *args;
+	double p50 = 0, p99 = 0;
+
+	/* subscribes on every fix spreading the types */
+	stub.listeners = 1;
+	for (i = 0 ; i < subscribers ; i++) {
+		args = json_object_new_object();
+		json_object_object_add(args, "type", json_object_new_string(type_NAMES[i % type_COUNT]));
+		json_object_object_add(args, "period", json_object_new_string("fix"));
+		subscribe(stub_req(args));
+		json_object_put(args);
+	}
+
+	/* warms the pools and the caches */
+	put_sentence(src, rmc, 0);
+	put_sentence(src, gga, 0);
+	ring_scan(src);
+	event_fix(src);
+
+	/* processes the frames */
+	latency_count = 0;
+	allocs = allocations;
+	for (i = 1 ; i <= frames ; i++) {
+		put_sentence(src, rmc, i);
+		put_sentence(src, gga, i);
+		frame_start = stub_now_ns();
+		ring_scan(src);
+		t = stub_now_ns();
+		event_fix(src);
+		tscan += t - frame_start;
+	}
+	allocs = allocations - allocs;
+
+	if (latency_count) {
+		qsort(latencies, latency_count, sizeof *latencies, cmp_u32);
+		p50 = latencies[latency_count / 2] / 1000.0;
+		p99 = latencies[latency_count * 99 / 100] / 1000.0;
+	}
+	printf("%11d %14.0f %12.2f %12.2f %10.2f %10.2f\n", subscribers,
+		1e9 * frames * SENTENCES_BY_FRAME / (double)tscan,
+		(double)tscan / (frames * SENTENCES_BY_FRAME),
+		(double)allocs / frames, p50, p99);
+
+	/* releases the events on the next fix */
+	stub.listeners = 0;
+	src->seq++;
+	event_fix(src);
+}
+
+/*
+ * the counts of subscribers to measure
+ */
+static const int defaults[] = { 0, 1, 8, 64, 256 };
+
+static int subscribers_of(int ac, char **av, int index)
+{
+	return ac > 2 ? atoi(av[index + 2]) : defaults[index];
+}
+
+int main(int ac, char **av)
+{
+	int frames, i, count, max;
+	struct source *src;
+
+	frames = ac > 1 ? atoi(av[1]) : 10000;
+	if (frames <= 0) {
+		fprintf(stderr, "usage: %s [FRAMES [SUBSCRIBERS...]]\n", av[0]);
+		return 1;
+	}
+
+	if (stub_init() < 0) {
+		fprintf(stderr, "can't initialise the stub\n");
+		return 1;
+	}
+	nmea_scan_init();
+	setenv("AFBGPS_SOURCES", "bench=nmea://localhost:0", 1);
+	if (sources_init() < 0) {
+		fprintf(stderr, "can't create the source\n");
+		return 1;
+	}
+	src = list_of_sources;
+
+	/* allocates the latencies for the biggest count */
+	count = ac > 2 ? ac - 2 : (int)(sizeof defaults / sizeof *defaults);
+	for (max = 1, i = 0 ; i < count ; i++)
+		if (subscribers_of(ac, av, i) > max)
+			max = subscribers_of(ac, av, i);
+	latency_max = (size_t)frames * (size_t)max;
+	latencies = malloc(latency_max * sizeof *latencies);
+	if (latencies == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	stub.on_push = on_push;
+
+	printf("frames %d of %d sentences, transports %d\n", frames, SENTENCES_BY_FRAME, stub.transports);
+	printf("subscribers   sentences/s  ns/sentence allocs/frame    p50(us)    p99(us)\n");
+	for (i = 0 ; i < count ; i++)
+		measure(src, frames, subscribers_of(ac, av, i));
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stress of the subscriptions of the GPS binding
+ *
+ * Each cycle subscribes to SUBSCRIPTIONS distinct combinations of
+ * source, period and type, unsubscribes them by id and then lets the
+ * timer release the events left without listeners.
+ *
+ * It reports the time of each phase by subscription, that should not
+ * grow with the count of subscriptions, and checks that each phase
+ * succeeded and that the cycles after the first one reuse the nodes
+ * of the pools without allocating.
+ *
+ * usage: bench-gps-subscribe [SUBSCRIPTIONS [CYCLES]]
+ */
+
+#include "../binding/af-gps-binding.c"
+#include "afb-stub.h"
+
+#define PERIODS	31	/* count of periods by source, 100 ms to 3.1 s */
+
+int main(int ac, char **av)
+{
+	int subscriptions, cycles, cycle, i, nsrcs, errors;
+	int *ids;
+	char *list, name[20], period[20];
+	size_t len;
+	struct source *src;
+	struct json_object *args, *id;
+	uint64_t t0, t1, t2, t3, tsub = 0, tunsub = 0, trel = 0;
+	uint32_t slabs = 0;
+
+	subscriptions = ac > 1 ? atoi(av[1]) : 10000;
+	cycles = ac > 2 ? atoi(av[2]) : 10;
+	if (subscriptions <= 0 || cycles <= 0) {
+		fprintf(stderr, "usage: %s [SUBSCRIPTIONS [CYCLES]]\n", av[0]);
+		return 1;
+	}
+
+	/* creates enough sources for distinct subscriptions */
+	nsrcs = (subscriptions + PERIODS * type_COUNT - 1) / (PERIODS * type_COUNT);
+	list = malloc((size_t)nsrcs * 40);
+	ids = malloc((size_t)subscriptions * sizeof *ids);
+	if (list == NULL || ids == NULL || stub_init() < 0) {
+		fprintf(stderr, "can't initialise\n");
+		return 1;
+	}
+	for (len = 0, i = 0 ; i < nsrcs ; i++)
+		len += (size_t)sprintf(&list[len], "S%d=nmea://localhost:0 ", i);
+	setenv("AFBGPS_SOURCES", list, 1);
+	if (sources_init() < 0) {
+		fprintf(stderr, "can't create the sources\n");
+		return 1;
+	}
+
+	errors = 0;
+	for (cycle = 0 ; cycle < cycles ; cycle++) {
+		/* subscribes */
+		stub.listeners = 1;
+		t0 = stub_now_ns();
+		for (i = 0 ; i < subscriptions ; i++) {
+			snprintf(name, sizeof name, "S%d", i / (PERIODS * type_COUNT));
+			snprintf(period, sizeof period, "%d", 100 * (1 + (i / type_COUNT) % PERIODS));
+			args = json_object_new_object();
+			json_object_object_add(args, "source", json_object_new_string(name));
+			json_object_object_add(args, "type", json_object_new_string(type_NAMES[i % type_COUNT]));
+			json_object_object_add(args, "period", json_object_new_string(period));
+			subscribe(stub_req(args));
+			json_object_put(args);
+			if (strcmp(stub.status, "success") || !json_object_object_get_ex(stub.reply, "id", &id))
+				errors++;
+			else
+				ids[i] = json_object_get_int(id);
+		}
+
+		/* unsubscribes */
+		t1 = stub_now_ns();
+		for (i = 0 ; i < subscriptions ; i++) {
+			snprintf(period, sizeof period, "%d", ids[i]);
+			args = json_object_new_object();
+			json_object_object_add(args, "id", json_object_new_string(period));
+			unsubscribe(stub_req(args));
+			json_object_put(args);
+			if (strcmp(stub.status, "success"))
+				errors++;
+		}
+
+		/* releases the events on their next push */
+		t2 = stub_now_ns();
+		stub.listeners = 0;
+		for (src = list_of_sources ; src != NULL ; src = src->next)
+			src->seq++;
+		on_timer(NULL, now_us() + 3600000000, NULL);
+		t3 = stub_now_ns();
+		if (events_count != 0 || periods_count != 0 || heap_count != 0)
+			errors++;
+		if (event_pool.live != 0 || period_pool.live != 0)
+			errors++;
+		if (cycle == 0)
+			slabs = event_pool.slabs + period_pool.slabs;
+		else if (slabs != event_pool.slabs + period_pool.slabs)
+			errors++;
+
+		tsub += t1 - t0;
+		tunsub += t2 - t1;
+		trel += t3 - t2;
+	}
+
+	i = subscriptions * cycles;
+	printf("subscriptions %d, sources %d, cycles %d, errors %d\n", subscriptions, nsrcs, cycles, errors);
+	printf("subscribe:   %10.2f ns/subscription\n", (double)tsub / i);
+	printf("unsubscribe: %10.2f ns/subscription\n", (double)tunsub / i);
+	printf("release:     %10.2f ns/subscription\n", (double)trel / i);
+	printf("pools:       %u event slabs, %u period slabs\n", event_pool.slabs, period_pool.slabs);
+	return errors != 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the batches of Kalman filters
+ *
+ * A batch of FILTERS independent filters is updated ROUNDS times with
+ * synthetic angles and rates, first filter by filter with the scalar
+ * update, then in one call of the batch update.
+ *
+ * It reports the filter updates per second and per second and core,
+ * the cores being the threads of OpenMP when built with it, and checks
+ * that both ways give the same angles: exactly with SSE, whose
+ * operations are the ones of the scalar update in the same order.
+ *
+ * usage: bench-kalman [FILTERS [ROUNDS]]
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../binding/kalman-filter.h"
+
+#if defined(__SSE__) && !defined(__FMA__)
+#define TOLERANCE	0.0f	/* same operations in the same order */
+#else
+#define TOLERANCE	1e-3f	/* fused or estimated operations of NEON or FMA */
+#endif
+
+/*
+ * returns the current time in nanoseconds
+ */
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * fills the angles and rates of 'count' filters for the 'round'
+ */
+static void measures(float *accangle, float *rate, int count, int round)
+{
+	int i;
+
+	for (i = 0 ; i < count ; i++) {
+		accangle[i] = 30.0f * sinf((float)(round + i) * 0.01f);
+		rate[i] = 3.0f * cosf((float)(round + i) * 0.01f) + 0.5f;
+	}
+}
+
+int main(int ac, char **av)
+{
+	int filters, rounds, r, i, cores = 1;
+	struct kalman_batch single, batch;
+	float *accangle, *rate, maxdiff = 0;
+	uint64_t t, tsingle = 0, tbatch = 0;
+	double updates;
+
+	filters = ac > 1 ? atoi(av[1]) : 64;
+	rounds = ac > 2 ? atoi(av[2]) : 20000;
+	if (filters <= 0 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [FILTERS [ROUNDS]]\n", av[0]);
+		return 1;
+	}
+#ifdef _OPENMP
+	if (filters >= KALMAN_OMP_MIN)
+		cores = omp_get_max_threads();
+#endif
+
+	accangle = malloc((size_t)filters * sizeof *accangle);
+	rate = malloc((size_t)filters * sizeof *rate);
+	if (accangle == NULL || rate == NULL
+	 || kalman_batch_init(&single, filters, 0.01f, 0.0003f, 0.01f) < 0
+	 || kalman_batch_init(&batch, filters, 0.01f, 0.0003f, 0.01f) < 0) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (r = 0 ; r < rounds ; r++) {
+		measures(accangle, rate, filters, r);
+
+		/* filter by filter */
+		t = now_ns();
+		for (i = 0 ; i < filters ; i++)
+			kalman_update_1(single.angle, single.bias, single.p00, single.p01, single.p10, single.p11,
+					accangle, rate, 0.02f, single.q_angle, single.q_gyro, single.r_angle, i);
+		tsingle += now_ns() - t;
+
+		/* all at once */
+		t = now_ns();
+		kalman_batch_update(&batch, accangle, rate, 0.02f);
+		tbatch += now_ns() - t;
+	}
+
+	for (i = 0 ; i < filters ; i++)
+		maxdiff = fmaxf(maxdiff, fabsf(single.angle[i] - batch.angle[i]));
+
+	updates = (double)filters * rounds;
+	printf("filters %d, rounds %d, cores %d\n", filters, rounds, cores);
+	printf("single: %12.0f updates/s %8.2f ns/update\n", updates * 1e9 / (double)tsingle, (double)tsingle / updates);
+	printf("batch:  %12.0f updates/s %8.2f ns/update %12.0f updates/s/core\n",
+		updates * 1e9 / (double)tbatch, (double)tbatch / updates, updates * 1e9 / (double)tbatch / cores);
+	printf("angle max difference: %g degree\n", (double)maxdiff);
+
+	kalman_batch_free(&single);
+	kalman_batch_free(&batch);
+	free(accangle);
+	free(rate);
+	return maxdiff > TOLERANCE;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Micro-benchmark of the parsing of NMEA numbers of the GPS binding
+ *
+ * It compares the fixed point parsing of the binding to the former
+ * parsing based on atof and measures the full processing of recorded
+ * sentences (scan, checksum, split and conversion), of all of them and
+ * of the RMC ones alone against the target of TARGET_RMC ns by RMC.
+ */
+
+#include "../binding/af-gps-binding.c"
+
+#include <time.h>
+
+#define ROUNDS	200000
+#define TARGET_RMC	100	/* target time in ns of the processing of a RMC sentence */
+
+/*
+ * the source of the benchmark
+ */
+static struct source source = { .name = "bench" };
+
+/*
+ * recorded sentences
+ */
+static const char *const sentences[] = {
+	"$GPRMC,081836.000,A,4807.0381,N,01131.0002,E,0.02,31.66,280516,,,A*53\r\n",
+	"$GPGGA,081836.000,4807.0381,N,01131.0002,E,1,09,0.9,545.4,M,46.9,M,,*52\r\n",
+	"$GPRMC,081837.000,A,4807.0392,N,01131.0017,E,12.41,84.40,280516,,,A*6A\r\n",
+	"$GPGGA,081837.000,4807.0392,N,01131.0017,E,1,09,0.9,545.6,M,46.9,M,,*57\r\n",
+	"$GPRMC,081838.000,A,4807.0403,N,01131.0032,E,12.58,84.62,280516,,,A*65\r\n",
+	"$GPGGA,081838.000,4807.0403,N,01131.0032,E,1,10,0.8,545.9,M,46.9,M,,*56\r\n",
+	"$GPRMC,081839.000,A,4752.1234,N,00200.9876,W,35.10,271.05,280516,,,A*4B\r\n",
+	"$GPGGA,081839.000,4752.1234,N,00200.9876,W,2,11,0.7,12.3,M,47.0,M,,*70\r\n",
+};
+#define SENTENCE_COUNT	((int)(sizeof sentences / sizeof *sentences))
+
+/*
+ * angles of the recorded sentences
+ */
+static const char *const angles[] = {
+	"4807.0381", "01131.0002", "4807.0392", "01131.0017",
+	"4807.0403", "01131.0032", "4752.1234", "00200.9876"
+};
+#define ANGLE_COUNT	((int)(sizeof angles / sizeof *angles))
+
+/*
+ * the former interpretation of angles, based on atof
+ */
+static int atof_angle(const char *text, double *result)
+{
+	uint32_t x = 0;
+	double v;
+	int dotidx = (int)(strchrnul(text, '.') - text);
+
+	switch(dotidx) {
+	case 5:
+		x = x * 10 + (uint32_t)(text[dotidx - 5] - '0');
+		/* fall through */
+	case 4:
+		x = x * 10 + (uint32_t)(text[dotidx - 4] - '0');
+		/* fall through */
+	case 3:
+		x = x * 10 + (uint32_t)(text[dotidx - 3] - '0');
+		/* fall through */
+	case 2:
+		v = atof(&text[dotidx - 2]);
+		break;
+	default:
+		return 0;
+	}
+
+	*result = (double)x + v * 0.01666666666666666666666; /* 1 / 60 */
+	return 1;
+}
+
+/*
+ * returns the current time in nanoseconds
+ */
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * measures the interpretation of the angles
+ */
+static void bench_angles()
+{
+	int r, i;
+	uint64_t t0, t1, t2;
+	double a, b, sum = 0, maxdiff = 0;
+
+	for (i = 0 ; i < ANGLE_COUNT ; i++) {
+		atof_angle(angles[i], &a);
+		nmea_angle(angles[i], 180, &b);
+		maxdiff = fmax(maxdiff, fabs(a - b));
+	}
+
+	t0 = now_ns();
+	for (r = 0 ; r < ROUNDS ; r++)
+		for (i = 0 ; i < ANGLE_COUNT ; i++) {
+			atof_angle(angles[i], &a);
+			sum += a;
+		}
+	t1 = now_ns();
+	for (r = 0 ; r < ROUNDS ; r++)
+		for (i = 0 ; i < ANGLE_COUNT ; i++) {
+			nmea_angle(angles[i], 180, &a);
+			sum += a;
+		}
+	t2 = now_ns();
+
+	printf("angle atof:  %8.2f ns/angle\n", (double)(t1 - t0) / (ROUNDS * ANGLE_COUNT));
+	printf("angle fixed: %8.2f ns/angle\n", (double)(t2 - t1) / (ROUNDS * ANGLE_COUNT));
+	printf("angle max difference: %g degree (checksum %g)\n", maxdiff, sum);
+}
+
+/*
+ * measures the full processing of the recorded sentences, from the
+ * one of index 'first' by steps of 'step', and returns the time in ns
+ * by sentence
+ */
+static double bench_sentences(const char *title, int first, int step)
+{
+	struct ring *ring = &source.ring;
+	int r, i, count;
+	size_t len;
+	uint64_t t, total = 0, sentences0 = ring->sentences, errors0 = ring->checksum_errors;
+	double ns;
+
+	for (count = 0, r = 0 ; r < ROUNDS ; r++) {
+		/* fills the ring */
+		for (i = first ; i < SENTENCE_COUNT ; i += step) {
+			len = strlen(sentences[i]);
+			memcpy(&ring->base[ring->head & ring->mask], sentences[i], len);
+			ring->head += (uint32_t)len;
+			count++;
+		}
+
+		/* processes it */
+		t = now_ns();
+		ring_scan(&source);
+		total += now_ns() - t;
+	}
+
+	ns = (double)total / count;
+	printf("%s: %d accepted, %d checksum errors, %8.2f ns/sentence\n", title,
+		(int)(ring->sentences - sentences0), (int)(ring->checksum_errors - errors0), ns);
+	return ns;
+}
+
+int main(int ac, char **av)
+{
+	static struct afb_binding_interface itf;
+	double rmc;
+
+	afbitf = &itf;
+	nmea_scan_init();
+	if (ring_init(&source.ring) < 0 || history_init(&source.history, HISTORY_SIZE) < 0) {
+		fprintf(stderr, "can't allocate the ring\n");
+		return 1;
+	}
+
+	bench_angles();
+	bench_sentences("sentences", 0, 1);
+	rmc = bench_sentences("RMC      ", 0, 2);
+	printf("RMC target:  %8d ns/sentence, %s by %.2f ns\n", TARGET_RMC,
+		rmc <= TARGET_RMC ? "met" : "missed", fabs(rmc - TARGET_RMC));
+	return 0;
+}
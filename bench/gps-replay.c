@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replay of the recordings of the GPS binding
+ *
+ * It feeds back the bytes of a recording (see the verb 'record' and
+ * af-gps-record.h) with the timing of their reads, either on its
+ * standard output or to the first client connecting to a TCP port,
+ * that can be a source nmea://localhost:PORT of the binding.
+ *
+ * The speed multiplies the pace of the recording, 0 meaning as fast
+ * as possible. The deadlines are absolute so that the delays of
+ * writing don't drift, late chunks being written without delay.
+ *
+ * At the end it reports on the standard error the count of chunks and
+ * bytes written and the maximum lateness of the chunks.
+ *
+ * usage: gps-replay [-s SPEED] [-p PORT] [-l LOOPS] FILE
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <endian.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "../binding/af-gps-record.h"
+
+/*
+ * statistics of the replay
+ */
+static uint64_t chunks;
+static uint64_t bytes;
+static int64_t lateness;	/* maximum lateness in ns */
+
+/*
+ * returns the time 'ts' in nanoseconds
+ */
+static uint64_t ns_of(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + (uint64_t)ts->tv_nsec;
+}
+
+/*
+ * reads exactly 'length' bytes at 'buffer'
+ * returns 1 when read, 0 at end of file, -1 on error
+ */
+static int read_exact(FILE *file, void *buffer, size_t length)
+{
+	size_t rc = fread(buffer, 1, length, file);
+
+	if (rc == length)
+		return 1;
+	if (rc == 0 && feof(file))
+		return 0;
+	errno = ferror(file) ? errno : EPROTO;
+	return -1;
+}
+
+/*
+ * writes exactly 'length' bytes of 'buffer' to 'fd'
+ */
+static int write_exact(int fd, const char *buffer, size_t length)
+{
+	ssize_t rc;
+
+	while (length) {
+		rc = write(fd, buffer, length);
+		if (rc < 0) {
+			if (errno != EINTR)
+				return -1;
+		} else {
+			buffer += rc;
+			length -= (size_t)rc;
+		}
+	}
+	return 0;
+}
+
+/*
+ * waits the first client of the TCP 'port'
+ */
+static int accept_client(int port)
+{
+	int srv, fd, one = 1;
+	struct sockaddr_in6 addr = { .sin6_family = AF_INET6, .sin6_addr = IN6ADDR_ANY_INIT };
+
+	srv = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (srv < 0)
+		return -1;
+	addr.sin6_port = htons((uint16_t)port);
+	setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+	if (bind(srv, (struct sockaddr*)&addr, sizeof addr) < 0 || listen(srv, 1) < 0) {
+		close(srv);
+		return -1;
+	}
+	fprintf(stderr, "waiting a client on port %d\n", port);
+	do {
+		fd = accept4(srv, NULL, NULL, SOCK_CLOEXEC);
+	} while (fd < 0 && errno == EINTR);
+	close(srv);
+	return fd;
+}
+
+/*
+ * replays once the recording 'file' to 'fd' at 'speed'
+ */
+static int replay(FILE *file, int fd, double speed)
+{
+	uint8_t header[GPS_RECORD_HEADER];
+	char magic[GPS_RECORD_MAGIC_LENGTH];
+	char *buffer = NULL;
+	uint32_t length, size = 0;
+	uint64_t time, start, deadline;
+	struct timespec ts;
+	int rc;
+
+	if (read_exact(file, magic, sizeof magic) <= 0 || memcmp(magic, GPS_RECORD_MAGIC, sizeof magic)) {
+		fprintf(stderr, "not a recording\n");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = ns_of(&ts);
+	while ((rc = read_exact(file, header, sizeof header)) > 0) {
+		memcpy(&time, &header[0], sizeof time);
+		memcpy(&length, &header[8], sizeof length);
+		time = le64toh(time);
+		length = le32toh(length);
+		if (length > size) {
+			free(buffer);
+			buffer = malloc(length);
+			if (buffer == NULL) {
+				fprintf(stderr, "out of memory\n");
+				return -1;
+			}
+			size = length;
+		}
+		rc = read_exact(file, buffer, length);
+		if (rc <= 0) {
+			/* the end of file after a header is a truncation too */
+			rc = -1;
+			break;
+		}
+
+		/* waits the deadline of the chunk */
+		if (speed > 0) {
+			deadline = start + (uint64_t)((double)time * 1000 / speed);
+			ts.tv_sec = (time_t)(deadline / 1000000000);
+			ts.tv_nsec = (long)(deadline % 1000000000);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			if ((int64_t)(ns_of(&ts) - deadline) > lateness)
+				lateness = (int64_t)(ns_of(&ts) - deadline);
+		}
+
+		if (write_exact(fd, buffer, length) < 0) {
+			fprintf(stderr, "can't write: %m\n");
+			free(buffer);
+			return -1;
+		}
+		chunks++;
+		bytes += length;
+	}
+	free(buffer);
+	if (rc < 0) {
+		fprintf(stderr, "truncated recording\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int ac, char **av)
+{
+	int opt, port = 0, loops = 1, loop, fd;
+	double speed = 1;
+	FILE *file;
+
+	while ((opt = getopt(ac, av, "s:p:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		default:
+			optind = ac;
+			break;
+		}
+	}
+	if (optind + 1 != ac || speed < 0 || port < 0 || port > 65535 || loops < 0) {
+		fprintf(stderr, "usage: %s [-s SPEED] [-p PORT] [-l LOOPS] FILE\n", av[0]);
+		fprintf(stderr, "  SPEED: multiplier of the pace, 0 for maximum speed (default 1)\n");
+		fprintf(stderr, "  PORT:  TCP port to serve to its first client (default standard output)\n");
+		fprintf(stderr, "  LOOPS: count of replays, 0 for ever (default 1)\n");
+		return 1;
+	}
+
+	file = fopen(av[optind], "r");
+	if (file == NULL) {
+		fprintf(stderr, "can't open %s: %m\n", av[optind]);
+		return 1;
+	}
+
+	/* a closed peer is reported as an error of write */
+	signal(SIGPIPE, SIG_IGN);
+	fd = port ? accept_client(port) : 1;
+	if (fd < 0) {
+		fprintf(stderr, "can't serve port %d: %m\n", port);
+		return 1;
+	}
+
+	for (loop = 0 ; !loops || loop < loops ; loop++) {
+		rewind(file);
+		if (replay(file, fd, speed) < 0)
+			break;
+	}
+
+	fprintf(stderr, "replayed %llu chunks, %llu bytes, maximum lateness %.3f ms\n",
+		(unsigned long long)chunks, (unsigned long long)bytes, (double)lateness / 1000000);
+	return !loops || loop < loops;
+}
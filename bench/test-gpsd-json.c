@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Test of the reader of the JSON reports of gpsd
+ *
+ * Reports, some of them holding NUL bytes, are put in the ring of a
+ * source gpsd+json and scanned. The malformed ones must be counted and
+ * rejected without blocking the scan, an alarm failing the test if the
+ * scan doesn't end.
+ *
+ * usage: test-gpsd-json
+ */
+
+#include "../binding/af-gps-binding.c"
+#include "afb-stub.h"
+
+/*
+ * the reports and whether they are accepted
+ */
+static const struct {
+	const char *text;
+	size_t length;
+	int accepted;
+} reports[] = {
+#define REPORT(text,accepted) { text, sizeof text - 1, accepted }
+	REPORT("{\"class\":\"TPV\",\"mode\":3,\"lat\":48.1,\"lon\":11.5}", 1),
+	REPORT("{\"x\":[1\0]}", 0),
+	REPORT("{\"x\":{\"y\":\0}}", 0),
+	REPORT("{\"x\":[true,\0\0]}", 0),
+	REPORT("{\"x\":\0,\"class\":\"TPV\"}", 0),
+	REPORT("{\"x\":[1,2],\"class\":\"TPV\",\"mode\":2}", 1),
+#undef REPORT
+};
+#define REPORT_COUNT (int)(sizeof reports / sizeof *reports)
+
+/*
+ * appends the report of 'index' and its end of line to the ring of 'src'
+ */
+static void put_report(struct source *src, int index)
+{
+	memcpy(&src->ring.base[src->ring.head & src->ring.mask], reports[index].text, reports[index].length);
+	src->ring.head += (uint32_t)reports[index].length;
+	src->ring.base[src->ring.head++ & src->ring.mask] = '\n';
+}
+
+int main(int ac, char **av)
+{
+	struct source *src;
+	uint64_t sentences, malformed;
+	int i, errors = 0;
+
+	if (stub_init() < 0) {
+		fprintf(stderr, "can't initialise the stub\n");
+		return 1;
+	}
+	nmea_scan_init();
+	setenv("AFBGPS_SOURCES", "test=gpsd+json://localhost:0", 1);
+	if (sources_init() < 0) {
+		fprintf(stderr, "can't create the source\n");
+		return 1;
+	}
+	src = list_of_sources;
+
+	/* a scan that doesn't end is killed */
+	alarm(10);
+	for (i = 0 ; i < REPORT_COUNT ; i++) {
+		sentences = src->ring.sentences;
+		malformed = src->ring.malformed;
+		put_report(src, i);
+		src->scan(src);
+		if (src->ring.sentences - sentences != (uint64_t)reports[i].accepted
+		 || src->ring.malformed - malformed != (uint64_t)!reports[i].accepted
+		 || src->ring.tail != src->ring.head) {
+			fprintf(stderr, "report %d: wrong scan\n", i);
+			errors++;
+		}
+	}
+	printf("%d reports, %d errors\n", REPORT_COUNT, errors);
+	return errors != 0;
+}
@@ -19,12 +19,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <math.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
 
 #include <json-c/json.h>
 
@@ -33,6 +37,8 @@
 #include <afb/afb-binding.h>
 #include <afb/afb-service-itf.h>
 
+#include "kalman-filter.h"
+
 
 /* Some useful math values
  * RAD_TO_DEG = 180 / pi 
@@ -45,8 +51,32 @@
 #define IMU_MAG 1
 #define IMU_GYR 2
 
+#define IMU_COUNT 3
+
 #define NB_AXIS 3
 
+#define G_GAIN 0.070	/* [deg/s/LSB] rate of the gyroscope */
+
+#define Q_ANGLE 0.01f	/* process noise of the angles of the Kalman filter */
+#define Q_GYRO  0.0003f	/* process noise of the biases of the gyroscope */
+#define R_ANGLE 0.01f	/* measurement noise of the angles of the accelerometer */
+#define MAX_DT  0.5f	/* maximal elapsed time in s between filtered samples */
+
+#define EVENT_BATCH 64	/* count of input events read at once */
+
+#define DEFAULT_BATCH   10	/* default count of samples by event */
+#define MAX_BATCH       256	/* maximal count of samples by event */
+#define DEFAULT_LATENCY 100	/* default latency of the samples in ms */
+#define MIN_LATENCY     1	/* minimal latency of the samples in ms */
+#define MAX_LATENCY     10000	/* maximal latency of the samples in ms */
+#define TIMER_ACCURACY  1000	/* accuracy of the timer of events in us */
+
+/* the time of input events, named differently by recent kernel headers */
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
 /* Association code as IMU use absolute values */
 char *absolutes[ABS_MAX + 1] = {
     [0 ... ABS_MAX] = NULL,
@@ -76,55 +106,258 @@ char *absolutes[ABS_MAX + 1] = {
 /***************************************************************************************/
 
 /*
- * @brief Open IMU event device and return file handler
- * 
+ * A sample of a sensor: the values of its axis at a time
+ */
+struct sample {
+	uint64_t time;			/* time of the sample in us (CLOCK_MONOTONIC) */
+	int32_t values[NB_AXIS];	/* raw values of the X, Y and Z axis */
+};
+
+/*
+ * A sensor read through its event device
+ *
+ * The kernel reports the changed axis of a sample as EV_ABS events
+ * terminated by a SYN_REPORT. The axis not reported keep their value.
+ */
+struct sensor {
+	const char *name;		/* name of the sensor, also name of its events */
+	const char *key;		/* short name of the sensor */
+	int fd;				/* file of the event device or -1 */
+	sd_event_source *evsrc;		/* the event loop source of fd */
+	int dropped;			/* boolean indication of events dropped by the kernel */
+	struct sample pending;		/* the sample being assembled */
+	struct sample last;		/* the last complete sample */
+	int newsample;			/* boolean indication that last changed since json */
+	struct json_object *json;	/* the JSON object of the last sample or NULL */
+	uint64_t samples;		/* count of complete samples */
+	uint64_t drops;			/* count of losses of events */
+	struct event *events;		/* head of the list of its events */
+};
+
+/*
+ * An event delivering the samples of a sensor by batches
+ *
+ * The samples are queued until the batch is full or until the first
+ * queued sample is 'latency' ms old.
+ */
+struct event {
+	struct event *next;		/* link to the next event of the sensor */
+	int id;				/* id of the event for unsubscribe */
+	int sensor;			/* index of the sensor */
+	uint32_t batch;			/* count of samples by event */
+	uint32_t latency;		/* maximal latency of the samples in ms */
+	uint32_t count;			/* count of samples queued */
+	uint64_t due;			/* time of the push in us if count != 0 */
+	struct afb_event event;		/* the afb event */
+	struct sample samples[];	/* the queued samples */
+};
+
+/*
+ * the interface to afb-daemon
+ */
+const struct afb_binding_interface *afbitf;
+
+/*
+ * the sensors indexed by their event device
+ */
+static struct sensor sensors[IMU_COUNT] = {
+	[IMU_ACC] = { .name = "accelerometer", .key = "acc", .fd = -1 },
+	[IMU_MAG] = { .name = "magnetometer", .key = "mag", .fd = -1 },
+	[IMU_GYR] = { .name = "gyroscope", .key = "gyr", .fd = -1 }
+};
+
+/*
+ * the timer of the events with a latency
+ */
+static sd_event_source *timer;
+
+/*
+ * the angles filtered from the samples of the accelerometer and of the gyroscope
+ */
+static struct kalman kalman;
+static uint64_t kalman_time;	/* time of the last update in us or 0 */
+
+static void event_sample(struct sensor *sensor);
+static void kalman_sample();
+
+/*
+ * @brief Read the current values of the axis of the sensor
+ *
+ * It is only used when opening the device and after a loss of events,
+ * the streaming of events giving the changes otherwise.
+ *
+ * @param struct sensor *sensor: the sensor to synchronize
+ *
+ */
+static void sensor_sync(struct sensor *sensor)
+{
+	int i;
+	struct input_absinfo absinfo;
+
+	for (i = 0; i < NB_AXIS; i++) {
+		if (ioctl(sensor->fd, EVIOCGABS(ABS_X + (unsigned)i), &absinfo) < 0)
+			ERROR(afbitf, "can't get axis %s of %s: %m", absolutes[ABS_X + i], sensor->name);
+		else
+			sensor->pending.values[i] = absinfo.value;
+	}
+}
+
+/*
+ * @brief Process the input events read from the device of the sensor
+ *
+ * The values of the axis are assembled in the pending sample until
+ * a SYN_REPORT makes it the last sample, stamped with the time of the
+ * report. After a SYN_DROPPED, the events are ignored until the next
+ * SYN_REPORT and the values are read again from the device.
+ *
+ * @param struct sensor *sensor: the sensor
+ * @param struct input_event *events: the events read
+ * @param int count: the count of events
+ *
+ */
+static void sensor_events(struct sensor *sensor, const struct input_event *events, int count)
+{
+	const struct input_event *ev, *end;
+
+	for (ev = events, end = &events[count] ; ev != end ; ev++) {
+		switch (ev->type) {
+		case EV_ABS:
+			if (!sensor->dropped && ev->code < ABS_X + NB_AXIS)
+				sensor->pending.values[ev->code - ABS_X] = ev->value;
+			break;
+		case EV_SYN:
+			if (ev->code == SYN_DROPPED) {
+				sensor->dropped = 1;
+				sensor->drops++;
+			} else if (ev->code == SYN_REPORT) {
+				if (sensor->dropped) {
+					sensor->dropped = 0;
+					sensor_sync(sensor);
+				}
+				sensor->pending.time = (uint64_t)ev->input_event_sec * 1000000 + (uint64_t)ev->input_event_usec;
+				sensor->last = sensor->pending;
+				sensor->newsample = 1;
+				sensor->samples++;
+				if (sensor == &sensors[IMU_GYR])
+					kalman_sample();
+				if (sensor->events != NULL)
+					event_sample(sensor);
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * @brief Close the device of the sensor
+ *
+ * @param struct sensor *sensor: the sensor
+ *
+ */
+static void sensor_close(struct sensor *sensor)
+{
+	if (sensor->evsrc != NULL) {
+		sd_event_source_unref(sensor->evsrc);
+		sensor->evsrc = NULL;
+	}
+	if (sensor->fd >= 0) {
+		close(sensor->fd);
+		sensor->fd = -1;
+	}
+}
+
+/*
+ * @brief Called by the event loop when the device of the sensor is readable
+ *
+ * It reads the events by batches of EVENT_BATCH until none is pending.
+ *
+ */
+static int on_sensor(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+{
+	struct sensor *sensor = userdata;
+	struct input_event events[EVENT_BATCH];
+	ssize_t rc;
+
+	for (;;) {
+		rc = read(fd, events, sizeof events);
+		if (rc > 0)
+			sensor_events(sensor, events, (int)((size_t)rc / sizeof *events));
+		else if (rc == 0 || (errno != EINTR && errno != EAGAIN)) {
+			ERROR(afbitf, "%s lost: %s", sensor->name, rc == 0 ? "end of file" : strerror(errno));
+			sensor_close(sensor);
+			break;
+		} else if (errno == EAGAIN)
+			break;
+	}
+	return 0;
+}
+
+/*
+ * @brief Open IMU event device and stream its events through the event loop
+ *
  * IMU event device are :
  * 	0 : Accelerometer
  *  1 : Magnetometer
  *  2 : gyroscop
- * 
+ *
+ * The events are stamped with CLOCK_MONOTONIC, the clock of the timers
+ * of the event loop.
+ *
  * @param integer imu_device: indice of imu event device like described above.
- * 
- * @return int fd : file handler of opened device.
- * 
+ *
+ * @return int: 0 on success or -1 on error
+ *
  */
 static int open_dev(int imu_device)
 {
-    char *fname_path[64];
-    int fd;
+	char fname_path[64];
+	struct sensor *sensor = &sensors[imu_device];
+	struct timespec ts;
+	int rc, clock = CLOCK_MONOTONIC;
 
 	/* get dev full path */
-	snprintf(*fname_path, sizeof(*fname_path), "%s%d", IMU_DEV, imu_device);
-	
-	if ((fd = open(*fname_path, O_RDONLY)) < 0) {
-	    perror("evdev open");
-	    exit(1);
-	}
+	snprintf(fname_path, sizeof fname_path, "%s%d", IMU_DEV, imu_device);
 
-    return fd;
+	sensor->fd = open(fname_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (sensor->fd < 0) {
+		ERROR(afbitf, "can't open %s for %s: %m", fname_path, sensor->name);
+		return -1;
+	}
+	if (ioctl(sensor->fd, EVIOCSCLOCKID, &clock) < 0)
+		NOTICE(afbitf, "can't set the clock of %s: %m", sensor->name);
+
+	/* the current values are the first sample */
+	sensor_sync(sensor);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	sensor->pending.time = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+	sensor->last = sensor->pending;
+	sensor->newsample = 1;
+
+	rc = sd_event_add_io(afb_daemon_get_event_loop(afbitf->daemon), &sensor->evsrc,
+			sensor->fd, EPOLLIN, on_sensor, sensor);
+	if (rc < 0) {
+		sensor->evsrc = NULL;
+		ERROR(afbitf, "can't stream %s: %s", sensor->name, strerror(-rc));
+		sensor_close(sensor);
+		return -1;
+	}
+	return 0;
 }
 
 /*
- * @brief Get Accelerometer 3 Axis Raw values in g and fill AccellRaw array with it
- * 
- * @param integer fd: device file handler
- * @param integer *AccelRaw: pointer to an integer array that will contains returned values
- * 
+ * @brief Open the devices of all the sensors
+ *
+ * @return int: 0 if at least one sensor is streamed or -1 otherwise
+ *
  */
-static void get_AccRaw(int fd, int *AccelRaw)
+static int sensors_init()
 {
-    int i;
-	struct input_absinfo acc_absinfo;
+	int i, rc = -1;
 
-    // Limit scan to X, Y and Z axis as Accel only use those one.
-    for (i = 0; i < ACC_AXIS; i++)
-    {
-        if (ioctl(fd, EVIOCGABS(i), &absinfo) < 0)
-        {
-            perror("IOCTL : EVIOVGABS error");
-        }
-        AccelRaw[i] = absinfo.value;
-    }
+	for (i = 0; i < IMU_COUNT; i++)
+		if (open_dev(i) == 0)
+			rc = 0;
+	return rc;
 }
 
 /*
@@ -134,13 +367,385 @@ static void get_AccRaw(int fd, int *AccelRaw)
  * @param float *AccelAngles: pointer to an integer array that will contains returned values
  * 
  */
-static void get_AccAngles(int accRaw[3], float *AccelAngle)
+static void get_AccAngles(const int32_t accRaw[3], float *AccelAngle)
 {
 	//  TODO : Checks these formula...
-	AccelAngle[0] = (float) (atan2(accRaw[1],accRaw[2])+M_PI)*RAD_TO_DEG;
-    AccelAngle[1] = (float) (atan2(accRaw[2],accRaw[0])+M_PI)*RAD_TO_DEG;
-	AccelAngle[2] = (float) (atan2(accRaw[1],accRaw[0])+M_PI)*RAD_TO_DEG;
+	AccelAngle[0] = (float) ((atan2(accRaw[1],accRaw[2])+M_PI)*RAD_TO_DEG);
+    AccelAngle[1] = (float) ((atan2(accRaw[2],accRaw[0])+M_PI)*RAD_TO_DEG);
+	AccelAngle[2] = (float) ((atan2(accRaw[1],accRaw[0])+M_PI)*RAD_TO_DEG);
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: FORMATING JSON SAMPLES                                             **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * @brief Create the JSON object of a sample of a sensor
+ *
+ * The object has the fields:
+ *
+ *    time:  integer: the time of the sample in us (CLOCK_MONOTONIC)
+ *    raw:   array:   the raw values of the X, Y and Z axis
+ *    x, y, z: double: for the accelerometer, the angles in degrees,
+ *                     for the gyroscope, the rotation rates in degrees per second
+ *    x, y:  double:  for the magnetometer, the angles in degrees
+ *
+ * @param int imu_device: the index of the sensor
+ * @param struct sample *sample: the sample
+ *
+ * @return struct json_object *: the created object
+ *
+ */
+static struct json_object *new_sample(int imu_device, const struct sample *sample)
+{
+	struct json_object *json, *raw;
+	float angles[NB_AXIS];
+	int i;
+
+	json = json_object_new_object();
+	json_object_object_add(json, "time", json_object_new_int64((int64_t)sample->time));
+	raw = json_object_new_array();
+	for (i = 0; i < NB_AXIS; i++)
+		json_object_array_add(raw, json_object_new_int(sample->values[i]));
+	json_object_object_add(json, "raw", raw);
+
+	switch (imu_device) {
+	case IMU_ACC:
+	case IMU_MAG:
+		get_AccAngles(sample->values, angles);
+		json_object_object_add(json, "x", json_object_new_double(angles[0]));
+		json_object_object_add(json, "y", json_object_new_double(angles[1]));
+		if (imu_device == IMU_ACC)
+			json_object_object_add(json, "z", json_object_new_double(angles[2]));
+		break;
+	case IMU_GYR:
+		json_object_object_add(json, "x", json_object_new_double(sample->values[0] * G_GAIN));
+		json_object_object_add(json, "y", json_object_new_double(sample->values[1] * G_GAIN));
+		json_object_object_add(json, "z", json_object_new_double(sample->values[2] * G_GAIN));
+		break;
+	}
+	return json;
+}
+
+/*
+ * @brief Get the JSON object of the last sample of a sensor
+ *
+ * The object is built and rendered once for each sample, then shared
+ * by the requests until the next sample: it is not read from the device.
+ *
+ * @param int imu_device: the index of the sensor
+ *
+ * @return struct json_object *: a new reference to the object or NULL if
+ * the sensor has no sample
+ *
+ */
+static struct json_object *sample(int imu_device)
+{
+	struct sensor *sensor = &sensors[imu_device];
+	const char *str;
+	char *copy;
+
+	/* clean on new sample */
+	if (sensor->newsample) {
+		json_object_put(sensor->json);
+		sensor->json = NULL;
+		sensor->newsample = 0;
+	}
+
+	if (sensor->json == NULL) {
+		if (sensor->last.time == 0)
+			return NULL;
+		sensor->json = new_sample(imu_device, &sensor->last);
+
+		/* render it once, serializations of the object copying the rendered string */
+		str = json_object_to_json_string_ext(sensor->json, JSON_C_TO_STRING_PLAIN);
+		copy = strdup(str);
+		if (copy != NULL)
+			json_object_set_serializer(sensor->json, json_object_userdata_to_json_string, copy, json_object_free_userdata);
+	}
+	return json_object_get(sensor->json);
 }
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: FILTERING ANGLES                                                   **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * @brief Update the filtered angles with the last sample of the gyroscope
+ *
+ * The X, Y and Z axis are filtered in one pass (see kalman-filter.h)
+ * from the last angles of the accelerometer, brought to -/+ 180 degrees
+ * like in simple-kalman-filter-example.c, and the rates of the gyroscope.
+ * The filter restarts when samples are missing for more than MAX_DT.
+ *
+ */
+static void kalman_sample()
+{
+	const struct sample *gyr = &sensors[IMU_GYR].last;
+	float angles[KALMAN_AXIS] = { 0 }, rates[KALMAN_AXIS] = { 0 };
+	float dt;
+	int i;
+
+	if (sensors[IMU_ACC].last.time == 0)
+		return;
+
+	dt = (float)(gyr->time - kalman_time) * 1e-6f;
+	if (kalman_time == 0 || gyr->time <= kalman_time || dt > MAX_DT) {
+		kalman_init(&kalman, Q_ANGLE, Q_GYRO, R_ANGLE);
+		kalman_time = gyr->time;
+		return;
+	}
+	kalman_time = gyr->time;
+
+	get_AccAngles(sensors[IMU_ACC].last.values, angles);
+	angles[KALMAN_X] -= 180.0f;
+	angles[KALMAN_Y] += angles[KALMAN_Y] > 90.0f ? -270.0f : 90.0f;
+	angles[KALMAN_Z] -= 180.0f;
+	for (i = 0; i < NB_AXIS; i++)
+		rates[i] = (float)(gyr->values[i] * G_GAIN);
+	kalman_update(&kalman, angles, rates, dt);
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: MANAGING EVENTS                                                    **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * returns the current time in us (CLOCK_MONOTONIC) of the event loop
+ */
+static uint64_t now_us()
+{
+	uint64_t now;
+
+	sd_event_now(afb_daemon_get_event_loop(afbitf->daemon), CLOCK_MONOTONIC, &now);
+	return now;
+}
+
+static int on_timer(sd_event_source *s, uint64_t usec, void *userdata);
+
+/*
+ * @brief Arm the timer for the earliest due event, disable it if none is due
+ *
+ */
+static void timer_arm()
+{
+	int i, rc;
+	uint64_t due = 0;
+	struct event *e;
+
+	for (i = 0; i < IMU_COUNT; i++)
+		for (e = sensors[i].events ; e != NULL ; e = e->next)
+			if (e->count != 0 && (due == 0 || e->due < due))
+				due = e->due;
+
+	if (due == 0) {
+		if (timer != NULL)
+			sd_event_source_set_enabled(timer, SD_EVENT_OFF);
+	} else if (timer == NULL) {
+		rc = sd_event_add_time(afb_daemon_get_event_loop(afbitf->daemon), &timer,
+				CLOCK_MONOTONIC, due, TIMER_ACCURACY, on_timer, NULL);
+		if (rc < 0) {
+			timer = NULL;
+			ERROR(afbitf, "can't create the timer of events: %s", strerror(-rc));
+		}
+	} else {
+		sd_event_source_set_time(timer, due);
+		sd_event_source_set_enabled(timer, SD_EVENT_ONESHOT);
+	}
+}
+
+/*
+ * @brief Push the queued samples of the event
+ *
+ * The pushed object has the fields:
+ *
+ *    sensor:  string: the name of the sensor
+ *    samples: array:  the samples as arrays [time, x, y, z] of their
+ *                     time in us and raw values (see get_acc, get_gyr
+ *                     and get_mag for their conversion)
+ *
+ * @return int: the count of listeners of the event, 0 if none remains
+ *
+ */
+static int event_push(struct event *e)
+{
+	struct json_object *json, *samples, *item;
+	uint32_t i;
+	int j;
+
+	json = json_object_new_object();
+	json_object_object_add(json, "sensor", json_object_new_string(sensors[e->sensor].name));
+	samples = json_object_new_array();
+	for (i = 0 ; i < e->count ; i++) {
+		item = json_object_new_array();
+		json_object_array_add(item, json_object_new_int64((int64_t)e->samples[i].time));
+		for (j = 0 ; j < NB_AXIS ; j++)
+			json_object_array_add(item, json_object_new_int(e->samples[i].values[j]));
+		json_object_array_add(samples, item);
+	}
+	json_object_object_add(json, "samples", samples);
+	e->count = 0;
+	return afb_event_push(e->event, json);
+}
+
+/*
+ * @brief Remove the event from its sensor and free it
+ *
+ * @param struct event **pe: the link to the event in the list of its sensor
+ *
+ */
+static void event_free(struct event **pe)
+{
+	struct event *e = *pe;
+
+	*pe = e->next;
+	afb_event_drop(e->event);
+	free(e);
+}
+
+/*
+ * @brief Push the event and free it if it has no more listener
+ *
+ * @param struct event **pe: the link to the event in the list of its sensor
+ *
+ * @return struct event **: the link to the next event
+ *
+ */
+static struct event **event_flush(struct event **pe)
+{
+	if (event_push(*pe) != 0)
+		return &(*pe)->next;
+	event_free(pe);
+	return pe;
+}
+
+/*
+ * @brief Called by the timer when the queued samples of events are due
+ *
+ */
+static int on_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	int i;
+	struct event **pe;
+
+	for (i = 0; i < IMU_COUNT; i++) {
+		pe = &sensors[i].events;
+		while (*pe != NULL)
+			pe = (*pe)->count != 0 && (*pe)->due <= usec ? event_flush(pe) : &(*pe)->next;
+	}
+	timer_arm();
+	return 0;
+}
+
+/*
+ * @brief Queue the last sample of the sensor to its events
+ *
+ * The full batches are pushed at once. The first sample queued of an
+ * event sets its due time, so the timer is armed if needed.
+ *
+ * @param struct sensor *sensor: the sensor
+ *
+ */
+static void event_sample(struct sensor *sensor)
+{
+	struct event *e, **pe;
+	int arm = 0;
+
+	pe = &sensor->events;
+	while ((e = *pe) != NULL) {
+		e->samples[e->count++] = sensor->last;
+		if (e->count >= e->batch) {
+			arm |= e->batch != 1;
+			pe = event_flush(pe);
+		} else {
+			if (e->count == 1) {
+				e->due = now_us() + (uint64_t)e->latency * 1000;
+				arm = 1;
+			}
+			pe = &e->next;
+		}
+	}
+	if (arm)
+		timer_arm();
+}
+
+/*
+ * @brief Get the event of id
+ *
+ * @return struct event *: the event or NULL if none has the id
+ *
+ */
+static struct event *event_of_id(int id)
+{
+	int i;
+	struct event *e;
+
+	for (i = 0; i < IMU_COUNT; i++)
+		for (e = sensors[i].events ; e != NULL ; e = e->next)
+			if (e->id == id)
+				return e;
+	return NULL;
+}
+
+/*
+ * @brief Get the event of the sensor for the batch and the latency, creating it if needed
+ *
+ * @return struct event *: the event or NULL on error
+ *
+ */
+static struct event *event_get(int imu_device, int batch, int latency)
+{
+	static int id;
+	struct sensor *sensor = &sensors[imu_device];
+	struct event *e;
+	uint32_t b, l;
+
+	/* normalize the batch and the latency */
+	b = batch < 1 ? 1 : batch > MAX_BATCH ? MAX_BATCH : (uint32_t)batch;
+	l = latency < MIN_LATENCY ? MIN_LATENCY : latency > MAX_LATENCY ? MAX_LATENCY : (uint32_t)latency;
+
+	/* search the event */
+	e = sensor->events;
+	while (e != NULL && (e->batch != b || e->latency != l))
+		e = e->next;
+
+	/* creates the event if needed */
+	if (e == NULL) {
+		e = calloc(1, sizeof *e + b * sizeof *e->samples);
+		if (e == NULL)
+			return NULL;
+		e->event = afb_daemon_make_event(afbitf->daemon, sensor->name);
+		if (e->event.itf == NULL) {
+			free(e);
+			return NULL;
+		}
+		do {
+			id = id < INT_MAX ? id + 1 : 1;
+		} while(event_of_id(id) != NULL);
+		e->id = id;
+		e->sensor = imu_device;
+		e->batch = b;
+		e->latency = l;
+		e->next = sensor->events;
+		sensor->events = e;
+	}
+	return e;
+}
+
 /***************************************************************************************/
 /***************************************************************************************/
 /**                                                                                   **/
@@ -150,40 +755,65 @@ static void get_AccAngles(int accRaw[3], float *AccelAngle)
 /**                                                                                   **/
 /***************************************************************************************/
 /***************************************************************************************/
+static void ping (struct afb_req request)
+{
+	static int pingcount = 0;
+
+	json_object *query = afb_req_json(request);
+	afb_req_success_f(request, NULL, "Ping Binder Daemon count=%d query=%s", ++pingcount, json_object_to_json_string(query));
+}
+
 /*
- * Returns the type corresponding to the given name
+ * Returns the index of the sensor of the given name or short name
+ * or -1 if none has the name
  */
-static enum type type_of_name(const char *name)
+static int sensor_of_name(const char *name)
 {
-	enum type result;
-	if (name == NULL)
-		return type_DEFAULT;
-	for (result = 0 ; result != type_COUNT ; result++)
-		if (strcmp(type_NAMES[result], name) == 0)
-			return result;
-	return type_INVALID;
-}/*
- * extract a valid type from the request
+	int i;
+
+	if (name != NULL)
+		for (i = 0; i < IMU_COUNT; i++)
+			if (!strcmp(sensors[i].name, name) || !strcmp(sensors[i].key, name))
+				return i;
+	return -1;
+}
+
+/*
+ * extract a valid sensor from the request
  */
-static int get_type_for_req(struct afb_req req, enum type *type)
+static int get_sensor_for_req(struct afb_req req, int *imu_device)
 {
-	if ((*type = type_of_name(afb_req_value(req, "type"))) != type_INVALID)
+	if ((*imu_device = sensor_of_name(afb_req_value(req, "sensor"))) >= 0)
 		return 1;
-	afb_req_fail(req, "unknown-type", NULL);
+	afb_req_fail(req, "unknown-sensor", NULL);
 	return 0;
 }
 
+/*
+ * reply to the request with the last sample of the sensor
+ */
+static void reply_sample(struct afb_req req, int imu_device)
+{
+	struct json_object *json;
+
+	json = sample(imu_device);
+	if (json == NULL)
+		afb_req_fail_f(req, "unavailable", "no sample of the %s", sensors[imu_device].name);
+	else
+		afb_req_success(req, json, NULL);
+}
+
 /*
  * Get Gyroscope values reading from lsm9ds0 on board
  *
  * There isn't parameters needed
  *
  * returns the rotating dps about X, Y and Z (degrees per second)
+ * of the last sample (see new_sample)
  */
-
 static void get_gyr(struct afb_req req)
 {
-
+	reply_sample(req, IMU_GYR);
 }
 
 /*
@@ -191,10 +821,11 @@ static void get_gyr(struct afb_req req)
  *
  * There isn't parameters needed
  *
- * returns the X, Y and Z angles in degrees
+ * returns the X, Y and Z angles in degrees of the last sample (see new_sample)
  */
-static float get_acc(struct afb_req req)
+static void get_acc(struct afb_req req)
 {
+	reply_sample(req, IMU_ACC);
 }
 
 /*
@@ -202,21 +833,54 @@ static float get_acc(struct afb_req req)
  *
  * There isn't parameters needed
  *
- * returns the X, Y angles in degrees
+ * returns the X, Y angles in degrees of the last sample (see new_sample)
  */
 static void get_mag(struct afb_req req)
 {
+	reply_sample(req, IMU_MAG);
+}
+
+/*
+ * Get the angles filtered from the accelerometer and the gyroscope
+ *
+ * There isn't parameters needed
+ *
+ * returns an object with the fields:
+ *
+ *    time:    integer: the time of the last sample of the gyroscope in us
+ *    x, y, z: double:  the filtered angles in degrees
+ */
+static void get_angles(struct afb_req req)
+{
+	struct json_object *json;
 
+	if (kalman_time == 0)
+		afb_req_fail(req, "unavailable", "no sample of the accelerometer and the gyroscope");
+	else {
+		json = json_object_new_object();
+		json_object_object_add(json, "time", json_object_new_int64((int64_t)kalman_time));
+		json_object_object_add(json, "x", json_object_new_double(kalman.angle[KALMAN_X]));
+		json_object_object_add(json, "y", json_object_new_double(kalman.angle[KALMAN_Y]));
+		json_object_object_add(json, "z", json_object_new_double(kalman.angle[KALMAN_Z]));
+		afb_req_success(req, json, NULL);
+	}
 }
 
 /*
- * subscribe to notification of position
+ * subscribe to notification of the samples of a sensor
  *
  * parameters of the subscription are:
  *
- *    type:   string:  the type of position expected (defaults to WCS84 if not present)
- *                     see the list above (get_gps)
- *    period: integer: the expected period in milliseconds (defaults to 2000 if not present)
+ *    sensor:  string:  the sensor: acc, gyr or mag (or accelerometer,
+ *                      gyroscope or magnetometer)
+ *    batch:   integer: the count of samples by event, from 1 to 256
+ *                      (defaults to 10 if not present)
+ *    latency: integer: the maximal delay in milliseconds before pushing
+ *                      a partial batch, from 1 to 10000 (defaults to 100
+ *                      if not present)
+ *
+ * the event named after the sensor pushes every sample to the
+ * subscribers grouped in batches (see event_push)
  *
  * returns an object with 2 fields:
  *
@@ -225,21 +889,23 @@ static void get_mag(struct afb_req req)
  */
 static void subscribe(struct afb_req req)
 {
-	enum type type;
-	const char *period;
+	int imu_device;
+	const char *batch, *latency;
 	struct event *event;
 	struct json_object *json;
 
-	if (get_type_for_req(req, &type)) {
-		period = afb_req_value(req, "period");
-		event = event_get(type, period == NULL ? DEFAULT_PERIOD : atoi(period));
+	if (get_sensor_for_req(req, &imu_device)) {
+		batch = afb_req_value(req, "batch");
+		latency = afb_req_value(req, "latency");
+		event = event_get(imu_device, batch == NULL ? DEFAULT_BATCH : atoi(batch),
+				latency == NULL ? DEFAULT_LATENCY : atoi(latency));
 		if (event == NULL)
 			afb_req_fail(req, "out-of-memory", NULL);
 		else if (afb_req_subscribe(req, event->event) != 0)
 			afb_req_fail_f(req, "failed", "afb_req_subscribe returned an error: %m");
 		else {
 			json = json_object_new_object();
-			json_object_object_add(json, "name", json_object_new_string(event->name));
+			json_object_object_add(json, "name", json_object_new_string(sensors[imu_device].name));
 			json_object_object_add(json, "id", json_object_new_int(event->id));
 			afb_req_success(req, json, NULL);
 		}
@@ -281,10 +947,9 @@ static const struct afb_verb_desc_v1 binding_verbs[] = {
   { .name= "get_gyr"  , .session= AFB_SESSION_NONE, .callback= get_gyr , "Get Gyroscop values"},
   { .name= "get_acc"  , .session= AFB_SESSION_NONE, .callback= get_acc , "Get Accelerometer values"},
   { .name= "get_mag"  , .session= AFB_SESSION_NONE, .callback= get_mag , "Get Magnetometer values"},
-/* Kept to may be a future usage.
-  { .name= "subscribe",    .session= AFB_SESSION_NONE, .callback= subscribe,    .info= "subscribe to notification of position" },
+  { .name= "get_angles", .session= AFB_SESSION_NONE, .callback= get_angles, "Get angles filtered from Accelerometer and Gyroscope"},
+  { .name= "subscribe",    .session= AFB_SESSION_NONE, .callback= subscribe,    .info= "subscribe to batches of samples of a sensor" },
   { .name= "unsubscribe",  .session= AFB_SESSION_NONE, .callback= unsubscribe,  .info= "unsubscribe a previous subscription" },
-*/
   { .name= NULL } /* marker for end of the array */
 };
 
@@ -313,15 +978,6 @@ const struct afb_binding *afbBindingV1Register(const struct afb_binding_interfac
 
 int afbBindingV1ServiceInit(struct afb_service service)
 {
-	return connection();
-}
-const struct afb_binding_interface *interface;
-
-static void ping (struct afb_req request)
-{
-	static int pingcount = 0;
-
-	json_object *query = afb_req_json(request);
-	afb_req_success_f(request, NULL, "Ping Binder Daemon count=%d query=%s", ++pingcount, json_object_to_json_string(query));
+	return sensors_init();
 }
 
@@ -17,15 +17,27 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <math.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <json-c/json.h>
 
@@ -34,14 +46,40 @@
 #include <afb/afb-binding.h>
 #include <afb/afb-service-itf.h>
 
+#include "af-gps-record.h"
+
 #define NAUTICAL_MILE_IN_METER                     1852
 #define MILE_IN_METER                              1609.344
 #define KNOT_TO_METER_PER_SECOND                   0.5144444444         /* 1852 / 3600 */
 #define METER_PER_SECOND_TO_KNOT                   1.943844492          /* 3600 / 1852 */
 #define METER_PER_SECOND_TO_KILOMETER_PER_HOUR     3.6                  /* 3600 / 1000 */
 #define METER_PER_SECOND_TO_MILE_PER_HOUR          2.236936292          /* 3600 / 1609.344 */
+#define EARTH_RADIUS_IN_METER                      6371008.8            /* mean radius */
+#define DEGREE_TO_RADIAN                           0.01745329252        /* pi / 180 */
 
 #define DEFAULT_PERIOD   2000   /* 2 seconds */
+#define MIN_PERIOD       10     /* 10 milliseconds */
+#define MAX_PERIOD       60000  /* 1 minute */
+#define PERIOD_ON_FIX    0      /* period of events sent on every fix */
+#define BINARY_SIZE      69     /* size of the binary record, multiple of 3 for base64 */
+#define TIMER_ACCURACY   1000   /* accuracy of the timer of events in us */
+#define KEEPALIVE        60000  /* maximal delay in ms between pushes of events with thresholds */
+#define RETRY_MIN        500    /* first delay of reconnection in ms */
+#define RETRY_MAX        60000  /* maximal delay of reconnection in ms */
+#define DEFAULT_BAUDS    4800   /* default speed of serial devices (NMEA 0183) */
+
+#define NMEA_MAX_LENGTH  160    /* maximum length of accepted sentences */
+#define NMEA_MAX_FIELDS  32     /* maximum count of fields of accepted sentences */
+#define JSON_MAX_LENGTH  4000   /* maximum length of accepted gpsd reports */
+#define RING_SIZE        4096   /* minimal size of the ring buffer of the NMEA stream */
+#define HISTORY_SIZE     64     /* default count of fixes recorded by source */
+#define HISTORY_COUNT    10     /* default count of fixes returned by history */
+#define POOL_SLAB        32     /* count of nodes allocated at once by pools */
+#define RENDER_SIZE      512    /* size of the pooled rendered positions */
+#define HISTO_BITS       4      /* bits of precision of the histograms (6%) */
+#define HISTO_SUB        (1 << HISTO_BITS)
+#define HISTO_MAX_BITS   40     /* bits of the maximal value of the histograms */
+#define HISTO_COUNT      ((HISTO_MAX_BITS - HISTO_BITS + 1) * HISTO_SUB)
 
 /*
  * references:
@@ -58,6 +96,15 @@ struct flags {
 	unsigned altitude: 1;
 	unsigned speed: 1;
 	unsigned track: 1;
+	unsigned date: 1;
+	unsigned fix: 1;
+	unsigned used: 1;
+	unsigned inview: 1;
+	unsigned pdop: 1;
+	unsigned hdop: 1;
+	unsigned vdop: 1;
+	unsigned herr: 1;
+	unsigned verr: 1;
 };
 
 /* the gps data converted */
@@ -70,6 +117,15 @@ struct gps {
 	double altitude;
 	double speed;
 	double track;
+	uint32_t date;		/* date as decimal YYYYMMDD */
+	uint8_t fix;		/* fix mode: 1 none, 2 2D, 3 3D */
+	uint8_t used;		/* count of satellites used for the fix */
+	uint8_t inview;		/* count of satellites in view */
+	double pdop;		/* position dilution of precision */
+	double hdop;		/* horizontal dilution of precision */
+	double vdop;		/* vertical dilution of precision */
+	double herr;		/* horizontal error in meter (95% confidence) */
+	double verr;		/* vertical error in meter (95% confidence) */
 };
 
 /*
@@ -82,21 +138,57 @@ enum type {
 	type_dms_kmh,	/* longitude, latitude: degre°minute'second.xxx"X, track: degre, altitude: m, speed: km/h */
 	type_dms_mph,	/* longitude, latitude: degre°minute'second.xxx"X, track: degre, altitude: m, speed: mph  */
 	type_dms_kn,	/* longitude, latitude: degre°minute'second.xxx"X, track: degre, altitude: m, speed: kn   */
+	type_binary,	/* packed binary record, see new_binary */
 	type_COUNT,
 	type_DEFAULT = type_wgs84,
 	type_INVALID = -1
 };
 
+/*
+ * the kind of link to a source
+ */
+enum kind {
+	kind_tcp,		/* TCP socket to a host and a service */
+	kind_unix,		/* Unix domain socket */
+	kind_tty		/* serial device */
+};
+
+/*
+ * the state of the connection of a source
+ */
+enum state {
+	state_idle,		/* not connected, no attempt pending */
+	state_resolving,	/* resolving the host and the service */
+	state_connecting,	/* connecting to one of the addresses */
+	state_connected,	/* connected and reading */
+	state_waiting,		/* waiting before the next attempt */
+	state_COUNT
+};
+
 struct event;
+struct source;
 
 /*
  * for each expected period
  */
 struct period {
 	struct period *next;	/* link to the next other period */
+	struct period *keynext;	/* link in the index of periods */
 	struct event *events;	/* events for the period */
-	uint32_t period;	/* value of the period in ms */
-	uint32_t last;		/* last update of the period */
+	struct source *source;	/* the source of the period */
+	uint32_t period;	/* value of the period in ms or PERIOD_ON_FIX */
+	uint32_t seq;		/* sequence number of the last frame sent */
+	uint64_t due;		/* time of the next update in us (CLOCK_MONOTONIC) */
+	int index;		/* index in the scheduling heap */
+};
+
+/*
+ * minimal changes of the position for sending it, zero for not checking
+ */
+struct thresholds {
+	double distance;	/* distance in m */
+	double heading;		/* change of the track in degree */
+	double speed;		/* change of the speed in m/s */
 };
 
 /*
@@ -104,10 +196,186 @@ struct period {
  */
 struct event {
 	struct event *next;	/* link for the same period */
+	struct event *idnext;	/* link in the index of events */
 	const char *name;	/* name of the event */
 	struct afb_event event;	/* the event for the binder */
 	enum type type;		/* the type of data expected */
 	int id;			/* id of the event for unsubscribe */
+	int delta;		/* boolean indication of thresholds to check */
+	int sent;		/* boolean indication of a position sent */
+	struct thresholds min;	/* the thresholds of the changes to send */
+	struct gps last;	/* the fix last sent when checking thresholds */
+	uint64_t pushed;	/* time in us of the last push when checking thresholds */
+};
+
+/*
+ * offsets of the field delimiters of the sentence being scanned
+ */
+struct split {
+	uint32_t count;				/* count of commas found */
+	uint8_t sum;				/* exclusive or of the bytes scanned */
+	uint16_t commas[NMEA_MAX_FIELDS - 1];	/* offsets of the commas */
+};
+
+/*
+ * ring buffer for reading the NMEA stream
+ *
+ * the indexes are free running and are masked with its mask
+ * when accessing the memory
+ */
+struct ring {
+	char *base;		/* memory of the ring, mapped twice */
+	uint32_t size;		/* size of the ring, a power of 2 multiple of the page size */
+	uint32_t mask;		/* mask of the indexes, size - 1 */
+	uint32_t head;		/* index of the end of the received data */
+	uint32_t tail;		/* index of the start of the current sentence */
+	uint32_t scan;		/* index of the end of line scan */
+	int overflow;		/* boolean indication of a too long sentence */
+	struct split split;	/* delimiters of the current sentence */
+	uint64_t sentences;	/* count of sentences or gpsd reports accepted */
+	uint64_t checksum_errors; /* count of sentences rejected for bad checksum */
+	uint64_t too_long;	/* count of sentences rejected as too long */
+	uint64_t malformed;	/* count of gpsd reports rejected as malformed */
+};
+
+/*
+ * histogram of values, log-linear like HDR histograms
+ *
+ * The values lower than HISTO_SUB have their own bucket. The others are
+ * counted in the bucket of their HISTO_BITS + 1 most significant bits,
+ * so with a relative precision of 1 / HISTO_SUB.
+ */
+struct histogram {
+	uint64_t count;		/* count of values */
+	uint64_t sum;		/* sum of the values */
+	uint64_t max;		/* maximal value */
+	uint64_t buckets[HISTO_COUNT]; /* count of values by bucket */
+};
+
+/*
+ * statistics of the hot paths of a source
+ */
+struct stats {
+	uint64_t reads;		/* count of reads of the stream */
+	uint64_t bytes;		/* count of bytes read */
+	uint64_t pushes;	/* count of events pushed */
+	uint64_t drops;		/* count of events dropped for having no listener */
+	struct histogram read;	/* bytes got by read */
+	struct histogram scan;	/* ns of the scan of the bytes read */
+	struct histogram send;	/* ns of the sending of the events of a period */
+};
+
+/*
+ * pool of nodes of fixed size
+ *
+ * The nodes are allocated by slabs of POOL_SLAB nodes that are never
+ * released: freed nodes are kept in a list for being reused.
+ */
+struct pool {
+	size_t size;		/* size of the nodes */
+	void *free;		/* head of the list of free nodes */
+	uint32_t live;		/* count of nodes in use */
+	uint32_t idle;		/* count of nodes in the free list */
+	uint32_t slabs;		/* count of slabs allocated */
+};
+
+/*
+ * one fix of the history, guarded by a sequence lock
+ */
+struct slot {
+	uint32_t seq;		/* sequence lock: odd while the fix is written */
+	struct gps gps;		/* the fix */
+};
+
+/*
+ * history of the fixes of a source
+ *
+ * It is written by the event loop only and read without lock by the
+ * verbs: the readers copy the fix and retry if the sequence lock of
+ * its slot changed meanwhile.
+ */
+struct history {
+	struct slot *slots;	/* the slots, their count is a power of 2 */
+	uint32_t mask;		/* count of slots minus one */
+	uint32_t count;		/* count of fixes pushed, free running */
+};
+
+/*
+ * records the JSON object for sending positions
+ */
+struct cache {
+	struct json_object *time_ms;		/* time as double in millisecond */
+	struct json_object *latitude_wgs;	/* latitude as double in degree */
+	struct json_object *longitude_wgs;	/* longitude as double in degree */
+	struct json_object *latitude_dms;	/* latitude as string in d°m's.s"X */
+	struct json_object *longitude_dms;	/* longitude as string in d°m's.s"X */
+	struct json_object *altitude_m;		/* altitude as double in meter */
+	struct json_object *speed_ms;		/* speed as double in m/s */
+	struct json_object *speed_kmh;		/* speed as double in km/h */
+	struct json_object *speed_mph;		/* speed as double in mph */
+	struct json_object *speed_kn;		/* speed as double in kn */
+	struct json_object *track_d;		/* heading track as double in degree */
+	struct json_object *date_s;		/* date as string YYYY-MM-DD */
+	struct json_object *fix_i;		/* fix mode as integer */
+	struct json_object *used_i;		/* count of used satellites as integer */
+	struct json_object *inview_i;		/* count of satellites in view as integer */
+	struct json_object *pdop_d;		/* position dilution of precision as double */
+	struct json_object *hdop_d;		/* horizontal dilution of precision as double */
+	struct json_object *vdop_d;		/* vertical dilution of precision as double */
+	struct json_object *herr_m;		/* horizontal error as double in meter */
+	struct json_object *verr_m;		/* vertical error as double in meter */
+	struct json_object *positions[type_COUNT];	/* computed positions by type */
+};
+
+/*
+ * a source of NMEA data
+ */
+struct source {
+	struct source *next;	/* link to the next source */
+	const char *name;	/* name of the source, also name of its events */
+	char *host;		/* host to connect, path of the socket or of the device */
+	char *service;		/* service or port to connect, speed of the device */
+	int isgpsd;		/* boolean indication of a gpsd server */
+	int isjson;		/* boolean indication of gpsd JSON reports instead of NMEA */
+	void (*scan)(struct source *src); /* the scanner of the received data */
+	enum kind kind;		/* the kind of link */
+	speed_t speed;		/* the speed of the device */
+	struct sockaddr_un sun;	/* the address of the Unix domain socket */
+	struct addrinfo sunai;	/* the address info of the Unix domain socket */
+	enum state state;	/* state of the connection */
+	sd_event_source *evsrc;	/* the event loop source of the connection */
+	int efd;		/* eventfd signaling the end of the resolution */
+	sd_event_source *efdsrc; /* the event loop source of efd */
+	sd_event_source *retry;	/* the timer of the next attempt */
+	struct addrinfo hint;	/* the hint of the resolution */
+	struct gaicb gai;	/* the asynchronous resolution */
+	struct addrinfo *addr;	/* the next address to connect */
+	uint32_t backoff;	/* delay of the next attempt in ms */
+	uint64_t due;		/* time of the next attempt in us (CLOCK_MONOTONIC) */
+	uint64_t connections;	/* count of successful connections */
+	uint64_t failures;	/* count of failed attempts and of hangups */
+	const char *error;	/* the last error or NULL */
+	int recfd;		/* file of the recording or -1 */
+	uint64_t recstart;	/* start of the recording in us (CLOCK_MONOTONIC) */
+	struct ring ring;	/* the NMEA stream */
+	struct history history;	/* the last fixes, the current one being the last */
+	int newframes;		/* boolean indication of wether new frames are availables */
+	uint32_t seq;		/* sequence number of the frames */
+	uint64_t renders;	/* count of positions rendered */
+	struct stats *stats;	/* statistics of the hot paths */
+	struct cache cache;	/* the JSON objects of the last frame */
+	struct period *periods;	/* head of the list of periods */
+};
+
+/*
+ * names of the states
+ */
+static const char * const state_NAMES[state_COUNT] = {
+	"idle",
+	"resolving",
+	"connecting",
+	"connected",
+	"waiting"
 };
 
 /*
@@ -117,7 +385,8 @@ static const char * const type_NAMES[type_COUNT] = {
 	"WGS84",
 	"DMS.km/h",
 	"DMS.mph",
-	"DMS.kn"
+	"DMS.kn",
+	"BINARY"
 };
 
 /*
@@ -125,449 +394,1508 @@ static const char * const type_NAMES[type_COUNT] = {
  */
 const struct afb_binding_interface *afbitf;
 
+/* head of the list of sources */
+static struct source *list_of_sources;
+
 /*
- * records the raw frames
+ * scheduling of the periods: a binary min-heap ordered by due time
  */
-static struct gps frames[10];	/* a short memory for further computation if needed */
-static int frameidx;		/* index of the last frame (frames are in the reverse order) */
-static int newframes;		/* boolean indication of wether new frames are availables */
+static struct period **heap;	/* the heap of periods */
+static int heap_count;		/* count of periods in the heap */
+static int heap_size;		/* allocated size of the heap */
+static sd_event_source *timer;	/* the timer for the period of the heap's top */
 
 /*
- * records the JSON object for sending positions
+ * indexes of the events by id and of the periods by source and value
+ *
+ * they are hash tables of linked nodes whose count of buckets is a power
+ * of 2 doubled when the count of nodes exceeds it
  */
-static struct json_object *time_ms;		/* time as double in millisecond */
-static struct json_object *latitude_wgs;	/* latitude as double in degree */
-static struct json_object *longitude_wgs;	/* longitude as double in degree */
-static struct json_object *latitude_dms;	/* latitude as string in d°m's.s"X */
-static struct json_object *longitude_dms;	/* longitude as string in d°m's.s"X */
-static struct json_object *altitude_m;		/* altitude as double in meter */
-static struct json_object *speed_ms;		/* speed as double in m/s */
-static struct json_object *speed_kmh;		/* speed as double in km/h */
-static struct json_object *speed_mph;		/* speed as double in mph */
-static struct json_object *speed_kn;		/* speed as double in kn */
-static struct json_object *track_d;		/* heading track as double in degree */
+static struct event **events_by_id;	/* buckets of the events by id */
+static uint32_t events_mask;		/* count of buckets minus one */
+static uint32_t events_count;		/* count of events indexed */
+static struct period **periods_by_key;	/* buckets of the periods by source and value */
+static uint32_t periods_mask;		/* count of buckets minus one */
+static uint32_t periods_count;		/* count of periods indexed */
 
-static struct json_object *positions[type_COUNT];	/* computed positions by type */
+/*
+ * pools of the periods, of the events and of the rendered positions
+ */
+static struct pool period_pool = { .size = sizeof(struct period) };
+static struct pool event_pool = { .size = sizeof(struct event) };
+static struct pool render_pool = { .size = RENDER_SIZE };
 
-/* head of the list of periods */
-static struct period *list_of_periods;
+/*
+ * the event of the periodic statistics and its timer
+ */
+static struct afb_event stats_event;
+static sd_event_source *stats_timer;
+static uint32_t stats_period;		/* period in ms, 0 when disabled */
+static int stats_running;		/* boolean indication of a pending push */
 
 /***************************************************************************************/
 /***************************************************************************************/
 /**                                                                                   **/
 /**                                                                                   **/
-/**       SECTION: FORMATING JSON POSITIONS                                           **/
+/**       SECTION: POOLS OF NODES                                                     **/
 /**                                                                                   **/
 /**                                                                                   **/
 /***************************************************************************************/
 /***************************************************************************************/
 /*
- * Creates the JSON representation for Degree Minute Second representation of coordinates
+ * returns a node of the pool, filled with zeros, or NULL if out of memory
  */
-static struct json_object *new_dms(double a, int islat)
+static void *pool_alloc(struct pool *pool)
 {
-	char buffer[50], pos;
-	double D, M;
+	char *slab;
+	void *node;
+	uint32_t i;
 
-	if (islat) {
-		if (a >= 0)
-			pos = 'N';
-		else {
-			a = -a;
-			pos = 'S';
-		}
-	} else {
-		if (a <= 180)
-			pos = 'E';
-		else {
-			a = 360 - a;
-			pos = 'W';
+	/* allocates a slab when no free node remains */
+	if (pool->free == NULL) {
+		slab = malloc(POOL_SLAB * pool->size);
+		if (slab == NULL)
+			return NULL;
+		for (i = 0 ; i < POOL_SLAB ; i++) {
+			*(void**)&slab[i * pool->size] = pool->free;
+			pool->free = &slab[i * pool->size];
 		}
+		pool->idle += POOL_SLAB;
+		pool->slabs++;
 	}
-	D = floor(a);
-	a = (a - D) * 60;
-	M = floor(a);
-	a = (a - M) * 60;
-	sprintf(buffer, "%d°%d'%.3f\"%c", (int)D, (int)M, a, pos);
-	return json_object_new_string(buffer);
-}
 
-/*
- * adds the value (with reference count increment) if not null
- */
-static void addif(struct json_object *obj, const char *name, struct json_object *val)
-{
-	if (val != NULL)
-		json_object_object_add(obj, name, json_object_get(val));
+	/* takes the first free node */
+	node = pool->free;
+	pool->free = *(void**)node;
+	pool->idle--;
+	pool->live++;
+	return memset(node, 0, pool->size);
 }
 
 /*
- * release the object (put) and reset the pointer to null
+ * gives back the node to its pool
  */
-static void clear(struct json_object **obj)
+static void pool_free(struct pool *pool, void *node)
 {
-	json_object_put(*obj);
-	*obj = NULL;
+	*(void**)node = pool->free;
+	pool->free = node;
+	pool->idle++;
+	pool->live--;
 }
 
 /*
- * get the last/current position of type
+ * returns the statistics of the pool as a JSON object
  */
-static struct json_object *position(enum type type)
+static struct json_object *pool_stats(struct pool *pool)
 {
-	struct json_object *result;
-	struct gps *g0;
-
-	/* clean on new frame */
-	if (newframes) {
-		clear(&time_ms);
-		clear(&latitude_wgs);
-		clear(&longitude_wgs);
-		clear(&latitude_dms);
-		clear(&longitude_dms);
-		clear(&altitude_m);
-		clear(&speed_ms);
-		clear(&speed_kmh);
-		clear(&speed_mph);
-		clear(&speed_kn);
-		clear(&track_d);
-		clear(&positions[type_wgs84]);
-		clear(&positions[type_dms_kmh]);
-		clear(&positions[type_dms_mph]);
-		clear(&positions[type_dms_kn]);
-		newframes = 0;
-	}
-
-	/* get the result */
-	result = positions[type];
-	if (result == NULL) {
-		DEBUG(afbitf, "building position for type %s", type_NAMES[type]);
-
-		/* should build the result */
-		g0 = &frames[frameidx];
-		result = json_object_new_object();
-		if (result == NULL)
-			return NULL;
-		positions[type] = result;
-
-		/* set the result type */
-		json_object_object_add(result, "type", json_object_new_string(type_NAMES[type]));
-
-		/* build time, altitude and track */
-		if (time_ms == NULL && g0->set.time)
-			time_ms = json_object_new_double (g0->time);
-		addif(result, "time", time_ms);
-		if (altitude_m == NULL && g0->set.altitude)
-			altitude_m = json_object_new_double (g0->altitude);
-		addif(result, "altitude", altitude_m);
-		if (track_d == NULL && g0->set.track)
-			track_d = json_object_new_double (g0->track);
-		addif(result, "track", track_d);
-
-		/* build position */
-		switch (type) {
-		default:
-		case type_wgs84:
-			if (latitude_wgs == NULL && g0->set.latitude)
-				latitude_wgs = json_object_new_double (g0->latitude);
-			addif(result, "latitude", latitude_wgs);
-			if (longitude_wgs == NULL && g0->set.longitude)
-				longitude_wgs = json_object_new_double (g0->longitude);
-			addif(result, "longitude", longitude_wgs);
-			break;
-		case type_dms_kmh:
-		case type_dms_mph:
-		case type_dms_kn:
-			if (latitude_dms == NULL && g0->set.latitude)
-				latitude_dms = new_dms (g0->latitude, 1);
-			addif(result, "latitude", latitude_dms);
-			if (longitude_dms == NULL && g0->set.longitude)
-				longitude_dms = new_dms (g0->longitude, 0);
-			addif(result, "longitude", longitude_dms);
-			break;
-		}
-
-		/* build speed */
-		switch (type) {
-		default:
-		case type_wgs84:
-			if (speed_ms == NULL && g0->set.speed)
-				speed_ms = json_object_new_double (g0->speed);
-			addif(result, "speed", speed_ms);
-			break;
-		case type_dms_kmh:
-			if (speed_kmh == NULL && g0->set.speed)
-				speed_kmh = json_object_new_double (g0->speed * METER_PER_SECOND_TO_KILOMETER_PER_HOUR);
-			addif(result, "speed", speed_kmh);
-			break;
-		case type_dms_mph:
-			if (speed_mph == NULL && g0->set.speed)
-				speed_mph = json_object_new_double (g0->speed * METER_PER_SECOND_TO_MILE_PER_HOUR);
-			addif(result, "speed", speed_mph);
-			break;
-		case type_dms_kn:
-			if (speed_kn == NULL && g0->set.speed)
-				speed_kn = json_object_new_double (g0->speed * METER_PER_SECOND_TO_KNOT);
-			addif(result, "speed", speed_kn);
-			break;
-		}
-	}
+	struct json_object *json;
 
-	return json_object_get(result);
+	json = json_object_new_object();
+	json_object_object_add(json, "live", json_object_new_int64(pool->live));
+	json_object_object_add(json, "free", json_object_new_int64(pool->idle));
+	json_object_object_add(json, "slabs", json_object_new_int64(pool->slabs));
+	return json;
 }
 
 /***************************************************************************************/
 /***************************************************************************************/
 /**                                                                                   **/
 /**                                                                                   **/
-/**       SECTION: MANAGING EVENTS                                                    **/
+/**       SECTION: STATISTICS                                                         **/
 /**                                                                                   **/
 /**                                                                                   **/
 /***************************************************************************************/
 /***************************************************************************************/
 /*
- * get the event handler of given id
+ * returns the current time in ns (CLOCK_MONOTONIC) for measuring durations
  */
-static struct event *event_of_id(int id)
+static inline uint64_t stats_now_ns()
 {
-	struct period *p;
-	struct event *e;
+	struct timespec ts;
 
-	p = list_of_periods;
-	while(p != NULL) {
-		e = p->events;
-		p = p->next;
-		while(e != NULL) {
-			if (e->id == id)
-				return e;
-			e = e->next;
-		}
-	}
-	return NULL;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
 }
 
 /*
- * get the event handler for the type and the period
+ * returns the index of the bucket of 'value'
  */
-static struct event *event_get(enum type type, int period)
+static inline uint32_t histo_index(uint64_t value)
 {
-	static int id;
-	int shift;
-	uint32_t perio;
-	struct period *p, **pp, *np;
-	struct event *e;
+	uint32_t e;
 
-	/* normalize the period */
-	period = period <= 100 ? 1 : period > 60000 ? 600 : (period / 100);
-	shift = 0;
-	while((period >> shift) > 31)
-		shift++;
-	perio = (uint32_t)(100 * (((period >> shift) & 31) << shift));
+	if (value < HISTO_SUB)
+		return (uint32_t)value;
+	e = (uint32_t)(63 - __builtin_clzll(value));
+	if (e >= HISTO_MAX_BITS)
+		return HISTO_COUNT - 1;
+	return (e - HISTO_BITS + 1) * HISTO_SUB + (uint32_t)(value >> (e - HISTO_BITS)) - HISTO_SUB;
+}
 
-	/* search for the period */
-	pp = &list_of_periods;
-	p = *pp;
-	while(p != NULL && p->period < perio) {
-		pp = &p->next;
-		p = *pp;
-	}
+/*
+ * returns the lowest value of the bucket of 'index'
+ */
+static uint64_t histo_value(uint32_t index)
+{
+	uint32_t e;
 
-	/* create the period if it misses */
-	if (p == NULL || p->period != perio) {
-		np = calloc(1, sizeof *p);
-		if (np == NULL)
-			return NULL;
-		np->next = p;
-		np->period = perio;
-		*pp = np;
-		p = np;
-	}
+	if (index < HISTO_SUB)
+		return index;
+	e = index / HISTO_SUB + HISTO_BITS - 1;
+	return (uint64_t)(HISTO_SUB + index % HISTO_SUB) << (e - HISTO_BITS);
+}
 
-	/* search the type */
-	e = p->events;
-	while(e != NULL && e->type != type)
-		e = e->next;
+/*
+ * adds 'value' to the histogram
+ */
+static inline void histo_add(struct histogram *h, uint64_t value)
+{
+	h->count++;
+	h->sum += value;
+	if (value > h->max)
+		h->max = value;
+	h->buckets[histo_index(value)]++;
+}
 
-	/* creates the type if needed */
-	if (e == NULL) {
-		e = calloc(1, sizeof *e);
-		if (e == NULL)
-			return NULL;
+/*
+ * returns the value of the histogram at 'permille' per thousand,
+ * the middle of its bucket
+ */
+static uint64_t histo_percentile(struct histogram *h, uint32_t permille)
+{
+	uint64_t value, rank, count = 0;
+	uint32_t i;
 
-		e->name = "GPS"; /* TODO */
-		e->event = afb_daemon_make_event(afbitf->daemon, e->name);
-		if (e->event.itf == NULL) {
-			free(e);
-			return NULL;
+	rank = (h->count * permille + 999) / 1000;
+	for (i = 0 ; i < HISTO_COUNT - 1 ; i++) {
+		count += h->buckets[i];
+		if (count >= rank && count != 0) {
+			value = (histo_value(i) + histo_value(i + 1) - 1) / 2;
+			return value < h->max ? value : h->max;
 		}
-
-		e->next = p->events;
-		e->type = type;
-		do {
-			id++;
-			if (id < 0)
-				id = 1;
-		} while(event_of_id(id) != NULL);
-		e->id = id;
-		p->events = e;
 	}
-
-	return e;
+	return h->max;
 }
 
 /*
- * Sends the events if needed
+ * returns the summary of the histogram as a JSON object
  */
-static void event_send()
+static struct json_object *histo_stats(struct histogram *h)
 {
-	struct period *p, **pp;
-	struct event *e, **pe;
-	struct timeval tv;
-	uint32_t now;
-
-	/* skip if nothing is new */
-	if (!newframes)
-		return;
-
-	/* computes now */
-	gettimeofday(&tv, NULL);
-	now = (uint32_t)(tv.tv_sec * 1000) + (uint32_t)(tv.tv_usec / 1000);
+	struct json_object *json;
 
-	/* iterates over the periods */
-	pp = &list_of_periods;
-	p = *pp;
-	while (p != NULL) {
-		if (p->events == NULL) {
-			/* no event for the period, frees it */
-			*pp = p->next;
-			free(p);
-		} else {
-			if (p->period <= now - p->last) {
-				/* its time to refresh */
-				p->last = now;
-				pe = &p->events;
-				e = *pe;
-				while (e != NULL) {
-					/* sends the event */
-					if (afb_event_push(e->event, position(e->type)) != 0)
-						pe = &e->next;
-					else {
-						/* no more listeners, free the event */
-						*pe = e->next;
-						afb_event_drop(e->event);
-						free(e);
-					}
-					e = *pe;
-				}
-			}
-			pp = &p->next;
-		}
-		p = *pp;
-	}
+	json = json_object_new_object();
+	json_object_object_add(json, "count", json_object_new_int64((int64_t)h->count));
+	json_object_object_add(json, "mean", json_object_new_int64(h->count ? (int64_t)(h->sum / h->count) : 0));
+	json_object_object_add(json, "p50", json_object_new_int64((int64_t)histo_percentile(h, 500)));
+	json_object_object_add(json, "p90", json_object_new_int64((int64_t)histo_percentile(h, 900)));
+	json_object_object_add(json, "p99", json_object_new_int64((int64_t)histo_percentile(h, 990)));
+	json_object_object_add(json, "p999", json_object_new_int64((int64_t)histo_percentile(h, 999)));
+	json_object_object_add(json, "max", json_object_new_int64((int64_t)h->max));
+	return json;
 }
 
 /***************************************************************************************/
 /***************************************************************************************/
 /**                                                                                   **/
 /**                                                                                   **/
-/**       SECTION: HANDLING NMEA                                                      **/
+/**       SECTION: HISTORY OF THE FIXES                                               **/
 /**                                                                                   **/
 /**                                                                                   **/
 /***************************************************************************************/
 /***************************************************************************************/
 /*
- * interprets a nmea time
+ * allocates the history for at least 'size' fixes
  */
-static int nmea_time(const char *text, uint32_t *result)
+static int history_init(struct history *h, uint32_t size)
 {
-	uint32_t x;
-
-	if (text[0] < '0' || text[0] > '2'
-	 || text[1] < '0' || text[1] > (text[0] == '2' ? '3' : '9')
-	 || text[2] < '0' || text[2] > '5'
-	 || text[3] < '0' || text[3] > '9'
-	 || text[4] < '0' || text[4] > '5'
-	 || text[5] < '0' || text[5] > '9'
-	 || (text[6] != 0 && text[6] != '.'))
-		return 0;
-
-	x = (uint32_t)(text[0] - '0');
-	x = x * 10 + (uint32_t)(text[1]-'0');
-	x = x *  6 + (uint32_t)(text[2]-'0');
-	x = x * 10 + (uint32_t)(text[3]-'0');
-	x = x *  6 + (uint32_t)(text[4]-'0');
-	x = x * 10 + (uint32_t)(text[5]-'0');
-	x = x * 1000;
-	if (text[6] == '.') {
-		if (text[7] != 0) {
-			if (text[7] < '0' || text[7] > '9') return 0;
-			x += (uint32_t)(text[7]-'0') * 100;
-			if (text[8] != 0) {
-				if (text[8] < '0' || text[8] > '9') return 0;
-				x += (uint32_t)(text[8]-'0') * 10;
-				if (text[9] != 0) {
-					if (text[9] < '0' || text[9] > '9') return 0;
-					x += (uint32_t)(text[9]-'0');
-					if (text[10] != 0) {
-						if (text[10] < '0' || text[10] > '9') return 0;
-						x += text[10] > '5';
-					}
-				}
-			}
-		}
-	}
+	uint32_t n = 1;
 
-	*result = x;
-	return 1;
+	while (n < size && n < 0x10000)
+		n <<= 1;
+	h->slots = calloc(n, sizeof *h->slots);
+	if (h->slots == NULL)
+		return -1;
+	h->mask = n - 1;
+	h->count = 0;
+	return 0;
 }
 
 /*
- * interprets a nmea angle having minutes
+ * starts the writing of the current fix, of a new one if 'push'
+ * or if no fix exists, and returns it
+ *
+ * must be called only from the event loop, history_write_end ends it
  */
-static int nmea_angle(const char *text, double *result)
+static struct gps *history_write_begin(struct history *h, int push)
 {
-	uint32_t x = 0;
-	double v;
-	int dotidx = (int)(strchrnul(text, '.') - text);
+	struct slot *slot;
+	uint32_t count = h->count;
 
-	switch(dotidx) {
-	case 5:
-		if (text[dotidx - 5] < '0' || text[dotidx - 5] > '9')
-			return 0;
-		x = x * 10 + (uint32_t)(text[dotidx - 5] - '0');
-	case 4:
-		if (text[dotidx - 4] < '0' || text[dotidx - 4] > '9')
-			return 0;
-		x = x * 10 + (uint32_t)(text[dotidx - 4] - '0');
-	case 3:
-		if (text[dotidx - 3] < '0' || text[dotidx - 3] > '9')
-			return 0;
-		x = x * 10 + (uint32_t)(text[dotidx - 3] - '0');
-	case 2:
-		v = atof(&text[dotidx - 2]);
-		break;
-	case 1:
-		if (text[dotidx - 1] < '0' || text[dotidx - 1] > '9')
-			return 0;
-	case 0:
-		v = atof(text);
-		break;
-	default:
-		return 0;
+	if (push || count == 0) {
+		slot = &h->slots[count & h->mask];
+		__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&h->count, count + 1, __ATOMIC_RELAXED);
+	} else {
+		slot = &h->slots[(count - 1) & h->mask];
+		__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
 	}
+	return &slot->gps;
+}
 
-	*result = (double)x + v * 0.01666666666666666666666; /* 1 / 60 */
+/*
+ * ends the writing of the current fix
+ */
+static void history_write_end(struct history *h)
+{
+	struct slot *slot = &h->slots[(h->count - 1) & h->mask];
 
-	return 1;
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
 }
 
 /*
- * creates a new position for the given optionnal fields
- * returns 1 if correct or 0 if a format error exists
+ * returns the count of fixes pushed since the start
  */
-static int nmea_set(
-		const char *tim,
-		const char *lat, const char *latu,
+static uint32_t history_count(struct history *h)
+{
+	return __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * copies to 'gps' the fix of 'index' (counted from the start)
+ *
+ * returns 1 on success or 0 if the fix isn't available anymore or yet
+ */
+static int history_read(struct history *h, uint32_t index, struct gps *gps)
+{
+	struct slot *slot = &h->slots[index & h->mask];
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (history_count(h) - index - 1 > h->mask)
+			return 0;
+		if (seq & 1)
+			continue;
+		*gps = slot->gps;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED))
+			return 1;
+	}
+}
+
+/*
+ * copies to 'gps' the last fix, an empty one if none exists
+ */
+static void history_last(struct history *h, struct gps *gps)
+{
+	uint32_t count;
+
+	do {
+		count = history_count(h);
+		if (count == 0) {
+			memset(gps, 0, sizeof *gps);
+			return;
+		}
+	} while (!history_read(h, count - 1, gps));
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: FORMATING JSON POSITIONS                                           **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * Creates the JSON representation for Degree Minute Second representation of coordinates
+ */
+static struct json_object *new_dms(double a, int islat)
+{
+	char buffer[50], pos;
+	double D, M;
+
+	if (islat) {
+		if (a >= 0)
+			pos = 'N';
+		else {
+			a = -a;
+			pos = 'S';
+		}
+	} else {
+		if (a <= 180)
+			pos = 'E';
+		else {
+			a = 360 - a;
+			pos = 'W';
+		}
+	}
+	D = floor(a);
+	a = (a - D) * 60;
+	M = floor(a);
+	a = (a - M) * 60;
+	sprintf(buffer, "%d°%d'%.3f\"%c", (int)D, (int)M, a, pos);
+	return json_object_new_string(buffer);
+}
+
+/*
+ * Creates the JSON representation of the date YYYYMMDD
+ */
+static struct json_object *new_date(uint32_t date)
+{
+	char buffer[12];
+
+	snprintf(buffer, sizeof buffer, "%04u-%02u-%02u",
+		(unsigned)(date / 10000 % 10000), (unsigned)(date / 100 % 100), (unsigned)(date % 100));
+	return json_object_new_string(buffer);
+}
+
+/*
+ * writes the little endian representations of the values at 'to'
+ */
+static inline void put_u32(uint8_t *to, uint32_t value)
+{
+	value = htole32(value);
+	memcpy(to, &value, sizeof value);
+}
+
+static inline void put_u64(uint8_t *to, uint64_t value)
+{
+	value = htole64(value);
+	memcpy(to, &value, sizeof value);
+}
+
+static inline void put_f32(uint8_t *to, double value)
+{
+	float f = (float)value;
+	uint32_t u;
+
+	memcpy(&u, &f, sizeof u);
+	put_u32(to, u);
+}
+
+static inline void put_f64(uint8_t *to, double value)
+{
+	uint64_t u;
+
+	memcpy(&u, &value, sizeof u);
+	put_u64(to, u);
+}
+
+/*
+ * Creates the JSON representation of the packed binary record of the frame
+ *
+ * The record of BINARY_SIZE bytes is encoded in base64. All its values
+ * are little endian:
+ *
+ *  +========+======+=======================================================+
+ *  | offset | type | value                                                 |
+ *  +========+======+=======================================================+
+ *  |      0 | u8   | version of the record: 1                              |
+ *  |      1 | u8   | fix mode: 1 none, 2 2D, 3 3D                          |
+ *  |      2 | u8   | count of satellites used                              |
+ *  |      3 | u8   | count of satellites in view                           |
+ *  |      4 | u32  | flags of the fields set: bit 0 time, 1 latitude,      |
+ *  |        |      | 2 longitude, 3 altitude, 4 speed, 5 track, 6 date,    |
+ *  |        |      | 7 fix, 8 satellites used, 9 satellites in view,       |
+ *  |        |      | 10 pdop, 11 hdop, 12 vdop                             |
+ *  |      8 | u32  | time in milliseconds since midnight UTC               |
+ *  |     12 | u32  | date as decimal YYYYMMDD                              |
+ *  |     16 | f64  | latitude in degree, negative for south                |
+ *  |     24 | f64  | longitude in degree, east from 0 to 360 like WGS84    |
+ *  |     32 | f64  | altitude in meter                                     |
+ *  |     40 | f64  | speed in m/s                                          |
+ *  |     48 | f64  | track in degree                                       |
+ *  |     56 | f32  | pdop                                                  |
+ *  |     60 | f32  | hdop                                                  |
+ *  |     64 | f32  | vdop                                                  |
+ *  |     68 | u8   | reserved: 0                                           |
+ *  +========+======+=======================================================+
+ *
+ * Values of fields not set are zero.
+ */
+static struct json_object *new_binary(const struct gps *g)
+{
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint8_t rec[BINARY_SIZE];
+	char buffer[4 * ((BINARY_SIZE + 2) / 3)], *out;
+	uint32_t flags, v;
+	int i;
+
+	flags = (uint32_t)g->set.time
+		| (uint32_t)g->set.latitude << 1
+		| (uint32_t)g->set.longitude << 2
+		| (uint32_t)g->set.altitude << 3
+		| (uint32_t)g->set.speed << 4
+		| (uint32_t)g->set.track << 5
+		| (uint32_t)g->set.date << 6
+		| (uint32_t)g->set.fix << 7
+		| (uint32_t)g->set.used << 8
+		| (uint32_t)g->set.inview << 9
+		| (uint32_t)g->set.pdop << 10
+		| (uint32_t)g->set.hdop << 11
+		| (uint32_t)g->set.vdop << 12;
+
+	/* pack the record */
+	rec[0] = 1;
+	rec[1] = g->set.fix ? g->fix : 0;
+	rec[2] = g->set.used ? g->used : 0;
+	rec[3] = g->set.inview ? g->inview : 0;
+	put_u32(&rec[4], flags);
+	put_u32(&rec[8], g->set.time ? g->time : 0);
+	put_u32(&rec[12], g->set.date ? g->date : 0);
+	put_f64(&rec[16], g->set.latitude ? g->latitude : 0);
+	put_f64(&rec[24], g->set.longitude ? g->longitude : 0);
+	put_f64(&rec[32], g->set.altitude ? g->altitude : 0);
+	put_f64(&rec[40], g->set.speed ? g->speed : 0);
+	put_f64(&rec[48], g->set.track ? g->track : 0);
+	put_f32(&rec[56], g->set.pdop ? g->pdop : 0);
+	put_f32(&rec[60], g->set.hdop ? g->hdop : 0);
+	put_f32(&rec[64], g->set.vdop ? g->vdop : 0);
+	rec[68] = 0;
+
+	/* encode it in base64 (BINARY_SIZE is a multiple of 3) */
+	out = buffer;
+	for (i = 0 ; i < BINARY_SIZE ; i += 3) {
+		v = (uint32_t)rec[i] << 16 | (uint32_t)rec[i + 1] << 8 | rec[i + 2];
+		*out++ = b64[v >> 18];
+		*out++ = b64[(v >> 12) & 63];
+		*out++ = b64[(v >> 6) & 63];
+		*out++ = b64[v & 63];
+	}
+	return json_object_new_string_len(buffer, (int)(out - buffer));
+}
+
+/*
+ * adds the value (with reference count increment) if not null
+ */
+static void addif(struct json_object *obj, const char *name, struct json_object *val)
+{
+	if (val != NULL)
+		json_object_object_add(obj, name, json_object_get(val));
+}
+
+/*
+ * gives back to its pool the rendered string of the object
+ */
+static void render_free(struct json_object *obj, void *userdata)
+{
+	pool_free(&render_pool, userdata);
+}
+
+/*
+ * renders the object once as a string and makes it the serialization
+ * of the object, avoiding to format it again when pushed to many
+ * events or transports
+ *
+ * the string is copied in a node of the render pool or, when too long,
+ * duplicated
+ */
+static void render(struct source *src, struct json_object *obj)
+{
+	const char *str;
+	char *copy;
+	size_t len;
+
+	str = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN);
+	len = strlen(str);
+	if (len < RENDER_SIZE) {
+		copy = pool_alloc(&render_pool);
+		if (copy == NULL)
+			return;
+		memcpy(copy, str, len + 1);
+		json_object_set_serializer(obj, json_object_userdata_to_json_string, copy, render_free);
+	} else {
+		copy = strdup(str);
+		if (copy == NULL)
+			return;
+		json_object_set_serializer(obj, json_object_userdata_to_json_string, copy, json_object_free_userdata);
+	}
+	src->renders++;
+}
+
+/*
+ * release the object (put) and reset the pointer to null
+ */
+static void clear(struct json_object **obj)
+{
+	json_object_put(*obj);
+	*obj = NULL;
+}
+
+/*
+ * release the JSON objects of the cache
+ */
+static void cache_clear(struct cache *c)
+{
+	int type;
+
+	clear(&c->time_ms);
+	clear(&c->latitude_wgs);
+	clear(&c->longitude_wgs);
+	clear(&c->latitude_dms);
+	clear(&c->longitude_dms);
+	clear(&c->altitude_m);
+	clear(&c->speed_ms);
+	clear(&c->speed_kmh);
+	clear(&c->speed_mph);
+	clear(&c->speed_kn);
+	clear(&c->track_d);
+	clear(&c->date_s);
+	clear(&c->fix_i);
+	clear(&c->used_i);
+	clear(&c->inview_i);
+	clear(&c->pdop_d);
+	clear(&c->hdop_d);
+	clear(&c->vdop_d);
+	clear(&c->herr_m);
+	clear(&c->verr_m);
+	for (type = 0 ; type < type_COUNT ; type++)
+		clear(&c->positions[type]);
+}
+
+/*
+ * builds the position of type for the fix g0, the fields being
+ * taken from the cache c or made and recorded in it
+ */
+static struct json_object *new_position(struct cache *c, const struct gps *g0, enum type type)
+{
+	struct json_object *result;
+
+	result = json_object_new_object();
+	if (result == NULL)
+		return NULL;
+
+	/* set the result type */
+	json_object_object_add(result, "type", json_object_new_string(type_NAMES[type]));
+
+	/* the binary type only has the packed record */
+	if (type == type_binary) {
+		json_object_object_add(result, "data", new_binary(g0));
+		return result;
+	}
+
+	/* build time, altitude and track */
+	if (c->time_ms == NULL && g0->set.time)
+		c->time_ms = json_object_new_double (g0->time);
+	addif(result, "time", c->time_ms);
+	if (c->altitude_m == NULL && g0->set.altitude)
+		c->altitude_m = json_object_new_double (g0->altitude);
+	addif(result, "altitude", c->altitude_m);
+	if (c->track_d == NULL && g0->set.track)
+		c->track_d = json_object_new_double (g0->track);
+	addif(result, "track", c->track_d);
+
+	/* build date and quality of the fix */
+	if (c->date_s == NULL && g0->set.date)
+		c->date_s = new_date (g0->date);
+	addif(result, "date", c->date_s);
+	if (c->fix_i == NULL && g0->set.fix)
+		c->fix_i = json_object_new_int (g0->fix);
+	addif(result, "fix", c->fix_i);
+	if (c->used_i == NULL && g0->set.used)
+		c->used_i = json_object_new_int (g0->used);
+	addif(result, "satellites", c->used_i);
+	if (c->inview_i == NULL && g0->set.inview)
+		c->inview_i = json_object_new_int (g0->inview);
+	addif(result, "satellites-in-view", c->inview_i);
+	if (c->pdop_d == NULL && g0->set.pdop)
+		c->pdop_d = json_object_new_double (g0->pdop);
+	addif(result, "pdop", c->pdop_d);
+	if (c->hdop_d == NULL && g0->set.hdop)
+		c->hdop_d = json_object_new_double (g0->hdop);
+	addif(result, "hdop", c->hdop_d);
+	if (c->vdop_d == NULL && g0->set.vdop)
+		c->vdop_d = json_object_new_double (g0->vdop);
+	addif(result, "vdop", c->vdop_d);
+	if (c->herr_m == NULL && g0->set.herr)
+		c->herr_m = json_object_new_double (g0->herr);
+	addif(result, "accuracy", c->herr_m);
+	if (c->verr_m == NULL && g0->set.verr)
+		c->verr_m = json_object_new_double (g0->verr);
+	addif(result, "altitude-accuracy", c->verr_m);
+
+	/* build position */
+	switch (type) {
+	default:
+	case type_wgs84:
+		if (c->latitude_wgs == NULL && g0->set.latitude)
+			c->latitude_wgs = json_object_new_double (g0->latitude);
+		addif(result, "latitude", c->latitude_wgs);
+		if (c->longitude_wgs == NULL && g0->set.longitude)
+			c->longitude_wgs = json_object_new_double (g0->longitude);
+		addif(result, "longitude", c->longitude_wgs);
+		break;
+	case type_dms_kmh:
+	case type_dms_mph:
+	case type_dms_kn:
+		if (c->latitude_dms == NULL && g0->set.latitude)
+			c->latitude_dms = new_dms (g0->latitude, 1);
+		addif(result, "latitude", c->latitude_dms);
+		if (c->longitude_dms == NULL && g0->set.longitude)
+			c->longitude_dms = new_dms (g0->longitude, 0);
+		addif(result, "longitude", c->longitude_dms);
+		break;
+	}
+
+	/* build speed */
+	switch (type) {
+	default:
+	case type_wgs84:
+		if (c->speed_ms == NULL && g0->set.speed)
+			c->speed_ms = json_object_new_double (g0->speed);
+		addif(result, "speed", c->speed_ms);
+		break;
+	case type_dms_kmh:
+		if (c->speed_kmh == NULL && g0->set.speed)
+			c->speed_kmh = json_object_new_double (g0->speed * METER_PER_SECOND_TO_KILOMETER_PER_HOUR);
+		addif(result, "speed", c->speed_kmh);
+		break;
+	case type_dms_mph:
+		if (c->speed_mph == NULL && g0->set.speed)
+			c->speed_mph = json_object_new_double (g0->speed * METER_PER_SECOND_TO_MILE_PER_HOUR);
+		addif(result, "speed", c->speed_mph);
+		break;
+	case type_dms_kn:
+		if (c->speed_kn == NULL && g0->set.speed)
+			c->speed_kn = json_object_new_double (g0->speed * METER_PER_SECOND_TO_KNOT);
+		addif(result, "speed", c->speed_kn);
+		break;
+	}
+
+	return result;
+}
+
+/*
+ * get the last/current position of type for the source
+ */
+static struct json_object *position(struct source *src, enum type type)
+{
+	struct json_object *result;
+	struct gps g0;
+	struct cache *c = &src->cache;
+
+	/* clean on new frame */
+	if (src->newframes) {
+		cache_clear(c);
+		src->newframes = 0;
+	}
+
+	/* get the result */
+	result = c->positions[type];
+	if (result == NULL) {
+		DEBUG(afbitf, "building position of %s for type %s", src->name, type_NAMES[type]);
+
+		/* should build the result */
+		history_last(&src->history, &g0);
+		result = new_position(c, &g0, type);
+		if (result == NULL)
+			return NULL;
+		c->positions[type] = result;
+
+		/* render it once, serializations of the result copying the rendered string */
+		render(src, result);
+	}
+
+	return json_object_get(result);
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: MANAGING EVENTS                                                    **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * hash of the period of value 'period' for the source 'src'
+ */
+static uint32_t period_hash(struct source *src, uint32_t period)
+{
+	uint32_t h = (uint32_t)((uintptr_t)src >> 4) ^ period;
+
+	h *= 0x9e3779b1;
+	return h ^ (h >> 16);
+}
+
+/*
+ * doubles the buckets of the index of events
+ */
+static int events_grow()
+{
+	uint32_t i, size = events_by_id == NULL ? 16 : 2 * (events_mask + 1);
+	struct event **buckets, *e, *next;
+
+	buckets = calloc(size, sizeof *buckets);
+	if (buckets == NULL)
+		return -1;
+	for (i = 0 ; events_by_id != NULL && i <= events_mask ; i++)
+		for (e = events_by_id[i] ; e != NULL ; e = next) {
+			next = e->idnext;
+			e->idnext = buckets[(uint32_t)e->id & (size - 1)];
+			buckets[(uint32_t)e->id & (size - 1)] = e;
+		}
+	free(events_by_id);
+	events_by_id = buckets;
+	events_mask = size - 1;
+	return 0;
+}
+
+/*
+ * doubles the buckets of the index of periods
+ */
+static int periods_grow()
+{
+	uint32_t i, h, size = periods_by_key == NULL ? 16 : 2 * (periods_mask + 1);
+	struct period **buckets, *p, *next;
+
+	buckets = calloc(size, sizeof *buckets);
+	if (buckets == NULL)
+		return -1;
+	for (i = 0 ; periods_by_key != NULL && i <= periods_mask ; i++)
+		for (p = periods_by_key[i] ; p != NULL ; p = next) {
+			next = p->keynext;
+			h = period_hash(p->source, p->period) & (size - 1);
+			p->keynext = buckets[h];
+			buckets[h] = p;
+		}
+	free(periods_by_key);
+	periods_by_key = buckets;
+	periods_mask = size - 1;
+	return 0;
+}
+
+/*
+ * get the event handler of given id
+ */
+static struct event *event_of_id(int id)
+{
+	struct event *e;
+
+	if (events_by_id == NULL)
+		return NULL;
+	e = events_by_id[(uint32_t)id & events_mask];
+	while (e != NULL && e->id != id)
+		e = e->idnext;
+	return e;
+}
+
+/*
+ * adds the event to the index of events
+ */
+static int event_index(struct event *e)
+{
+	struct event **pe;
+
+	if (events_count > events_mask || events_by_id == NULL)
+		if (events_grow() < 0)
+			return -1;
+	pe = &events_by_id[(uint32_t)e->id & events_mask];
+	e->idnext = *pe;
+	*pe = e;
+	events_count++;
+	return 0;
+}
+
+/*
+ * removes the event from the index of events
+ */
+static void event_unindex(struct event *e)
+{
+	struct event **pe;
+
+	pe = &events_by_id[(uint32_t)e->id & events_mask];
+	while (*pe != e)
+		pe = &(*pe)->idnext;
+	*pe = e->idnext;
+	events_count--;
+}
+
+/*
+ * get the period of value 'period' for the source 'src'
+ */
+static struct period *period_of(struct source *src, uint32_t period)
+{
+	struct period *p;
+
+	if (periods_by_key == NULL)
+		return NULL;
+	p = periods_by_key[period_hash(src, period) & periods_mask];
+	while (p != NULL && (p->source != src || p->period != period))
+		p = p->keynext;
+	return p;
+}
+
+/*
+ * adds the period to the index of periods
+ */
+static int period_index(struct period *p)
+{
+	struct period **pp;
+
+	if (periods_count > periods_mask || periods_by_key == NULL)
+		if (periods_grow() < 0)
+			return -1;
+	pp = &periods_by_key[period_hash(p->source, p->period) & periods_mask];
+	p->keynext = *pp;
+	*pp = p;
+	periods_count++;
+	return 0;
+}
+
+/*
+ * removes the period from the index of periods
+ */
+static void period_unindex(struct period *p)
+{
+	struct period **pp;
+
+	pp = &periods_by_key[period_hash(p->source, p->period) & periods_mask];
+	while (*pp != p)
+		pp = &(*pp)->keynext;
+	*pp = p->keynext;
+	periods_count--;
+}
+
+/*
+ * places the period of the heap at index toward the top
+ */
+static void heap_up(struct period *p, int index)
+{
+	int parent;
+
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (heap[parent]->due <= p->due)
+			break;
+		heap[index] = heap[parent];
+		heap[index]->index = index;
+		index = parent;
+	}
+	heap[index] = p;
+	p->index = index;
+}
+
+/*
+ * places the period of the heap at index toward the bottom
+ */
+static void heap_down(struct period *p, int index)
+{
+	int child;
+
+	for (;;) {
+		child = 2 * index + 1;
+		if (child >= heap_count)
+			break;
+		if (child + 1 < heap_count && heap[child + 1]->due < heap[child]->due)
+			child++;
+		if (p->due <= heap[child]->due)
+			break;
+		heap[index] = heap[child];
+		heap[index]->index = index;
+		index = child;
+	}
+	heap[index] = p;
+	p->index = index;
+}
+
+/*
+ * adds the period to the heap
+ */
+static int heap_add(struct period *p)
+{
+	struct period **h;
+	int size;
+
+	if (heap_count == heap_size) {
+		size = heap_size ? 2 * heap_size : 16;
+		h = realloc(heap, (size_t)size * sizeof *heap);
+		if (h == NULL)
+			return -1;
+		heap = h;
+		heap_size = size;
+	}
+	heap_up(p, heap_count++);
+	return 0;
+}
+
+/*
+ * removes the top period of the heap and returns it
+ */
+static struct period *heap_pop()
+{
+	struct period *p = heap[0];
+
+	if (--heap_count > 0)
+		heap_down(heap[heap_count], 0);
+	p->index = -1;
+	return p;
+}
+
+/* declare the timer callback */
+static int on_timer(sd_event_source *s, uint64_t usec, void *userdata);
+
+/*
+ * arms the timer for the top of the heap
+ */
+static void timer_arm()
+{
+	int rc;
+
+	if (heap_count == 0) {
+		if (timer != NULL)
+			sd_event_source_set_enabled(timer, SD_EVENT_OFF);
+		return;
+	}
+
+	if (timer == NULL) {
+		rc = sd_event_add_time(afb_daemon_get_event_loop(afbitf->daemon), &timer,
+				CLOCK_MONOTONIC, heap[0]->due, TIMER_ACCURACY, on_timer, NULL);
+		if (rc < 0) {
+			timer = NULL;
+			ERROR(afbitf, "can't create the timer of events: %s", strerror(-rc));
+		}
+	} else {
+		sd_event_source_set_time(timer, heap[0]->due);
+		sd_event_source_set_enabled(timer, SD_EVENT_ONESHOT);
+	}
+}
+
+/*
+ * returns the current time in us (CLOCK_MONOTONIC) of the event loop
+ */
+static uint64_t now_us()
+{
+	uint64_t now;
+
+	sd_event_now(afb_daemon_get_event_loop(afbitf->daemon), CLOCK_MONOTONIC, &now);
+	return now;
+}
+
+/*
+ * returns the first time after 'usec' that is a multiple of 'period'
+ *
+ * aligning the due times of the periods on their multiples makes the
+ * compatible periods (e.g. 50 ms and 100 ms) due at the same time and
+ * so sent in the same run of the timer for the same frame
+ */
+static uint64_t period_align(uint64_t usec, uint32_t period)
+{
+	uint64_t q = (uint64_t)period * 1000;
+
+	return (usec / q + 1) * q;
+}
+
+/*
+ * get the event handler of the source for the type, the period and
+ * the thresholds
+ *
+ * the period is in milliseconds, PERIOD_ON_FIX for every fix
+ */
+static struct event *event_get(struct source *src, enum type type, int period, const struct thresholds *min)
+{
+	static int id;
+	uint32_t perio;
+	struct period *p;
+	struct event *e;
+
+	/* the period is valid (see get_period_for_req) */
+	perio = (uint32_t)period;
+
+	/* search for the period */
+	p = period_of(src, perio);
+
+	/* create the period if it misses */
+	if (p == NULL) {
+		p = pool_alloc(&period_pool);
+		if (p == NULL)
+			return NULL;
+		p->period = perio;
+		p->source = src;
+		p->seq = src->seq;
+		if (period_index(p) < 0) {
+			pool_free(&period_pool, p);
+			return NULL;
+		}
+		if (perio != PERIOD_ON_FIX) {
+			/* schedules the period now so that a known fix is sent
+			 * at once, the next times being aligned on the period */
+			if (history_count(&src->history))
+				p->seq--;
+			p->due = now_us();
+			if (heap_add(p) < 0) {
+				period_unindex(p);
+				pool_free(&period_pool, p);
+				return NULL;
+			}
+			timer_arm();
+		}
+		p->next = src->periods;
+		src->periods = p;
+	}
+
+	/* search the type and the thresholds */
+	e = p->events;
+	while(e != NULL && (e->type != type || e->min.distance != min->distance
+			|| e->min.heading != min->heading || e->min.speed != min->speed))
+		e = e->next;
+
+	/* creates the type if needed */
+	if (e == NULL) {
+		e = pool_alloc(&event_pool);
+		if (e == NULL)
+			return NULL;
+
+		e->name = src->name;
+		e->event = afb_daemon_make_event(afbitf->daemon, e->name);
+		if (e->event.itf == NULL) {
+			pool_free(&event_pool, e);
+			return NULL;
+		}
+
+		e->type = type;
+		e->min = *min;
+		e->delta = min->distance > 0 || min->heading > 0 || min->speed > 0;
+		do {
+			id++;
+			if (id < 0)
+				id = 1;
+		} while(event_of_id(id) != NULL);
+		e->id = id;
+		if (event_index(e) < 0) {
+			afb_event_drop(e->event);
+			pool_free(&event_pool, e);
+			return NULL;
+		}
+		e->next = p->events;
+		p->events = e;
+	}
+
+	return e;
+}
+
+/*
+ * tells whether the fix changed from the last one sent by the event
+ * more than the thresholds of the event
+ *
+ * a field appearing or disappearing is a change
+ */
+static int event_moved(struct event *e, const struct gps *fix)
+{
+	const struct gps *last = &e->last;
+	double dlat, dlon, d;
+
+	if (!e->sent)
+		return 1;
+
+	if (e->min.distance > 0) {
+		if (last->set.latitude != fix->set.latitude || last->set.longitude != fix->set.longitude)
+			return 1;
+		if (fix->set.latitude && fix->set.longitude) {
+			/* equirectangular approximation, accurate for small distances */
+			dlat = (fix->latitude - last->latitude) * DEGREE_TO_RADIAN;
+			dlon = (fix->longitude - last->longitude) * DEGREE_TO_RADIAN;
+			if (dlon > M_PI)
+				dlon -= 2 * M_PI;
+			else if (dlon < -M_PI)
+				dlon += 2 * M_PI;
+			dlon *= cos((fix->latitude + last->latitude) * (DEGREE_TO_RADIAN / 2));
+			d = e->min.distance / EARTH_RADIUS_IN_METER;
+			if (dlat * dlat + dlon * dlon >= d * d)
+				return 1;
+		}
+	}
+
+	if (e->min.heading > 0) {
+		if (last->set.track != fix->set.track)
+			return 1;
+		if (fix->set.track) {
+			d = fabs(fix->track - last->track);
+			if (d > 180)
+				d = 360 - d;
+			if (d >= e->min.heading)
+				return 1;
+		}
+	}
+
+	if (e->min.speed > 0) {
+		if (last->set.speed != fix->set.speed)
+			return 1;
+		if (fix->set.speed && fabs(fix->speed - last->speed) >= e->min.speed)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Sends the events of the period if new frames are available
+ */
+static void event_send(struct period *p)
+{
+	struct source *src = p->source;
+	struct event *e, **pe;
+	struct gps fix;
+	int fixed = 0;
+	uint64_t start, now = 0;
+
+	/* skip if nothing is new */
+	if (p->seq == src->seq)
+		return;
+	p->seq = src->seq;
+	start = stats_now_ns();
+
+	pe = &p->events;
+	e = *pe;
+	while (e != NULL) {
+		/* check the thresholds against the last fix sent, the
+		 * pushes of KEEPALIVE detecting the events without listener */
+		if (e->delta) {
+			if (!fixed) {
+				history_last(&src->history, &fix);
+				now = now_us();
+				fixed = 1;
+			}
+			if (!event_moved(e, &fix) && now - e->pushed < (uint64_t)KEEPALIVE * 1000) {
+				pe = &e->next;
+				e = *pe;
+				continue;
+			}
+			e->last = fix;
+			e->sent = 1;
+			e->pushed = now;
+		}
+
+		/* sends the event */
+		src->stats->pushes++;
+		if (afb_event_push(e->event, position(src, e->type)) != 0)
+			pe = &e->next;
+		else {
+			/* no more listeners, free the event */
+			src->stats->drops++;
+			*pe = e->next;
+			event_unindex(e);
+			afb_event_drop(e->event);
+			pool_free(&event_pool, e);
+		}
+		e = *pe;
+	}
+	histo_add(&src->stats->send, stats_now_ns() - start);
+}
+
+/*
+ * removes the period from the list of its source and frees it
+ */
+static void period_free(struct period *p)
+{
+	struct period **pp;
+
+	pp = &p->source->periods;
+	while (*pp != p)
+		pp = &(*pp)->next;
+	*pp = p->next;
+	period_unindex(p);
+	pool_free(&period_pool, p);
+}
+
+/*
+ * called by the timer when the top period of the heap is due
+ */
+static int on_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	struct period *p;
+
+	while (heap_count > 0 && heap[0]->due <= usec) {
+		p = heap_pop();
+		event_send(p);
+		if (p->events == NULL) {
+			/* no event for the period, frees it */
+			period_free(p);
+		} else {
+			/* schedule the next update */
+			p->due = period_align(p->due, p->period);
+			if (p->due <= usec)
+				p->due = period_align(usec, p->period);
+			heap_add(p);
+		}
+	}
+	timer_arm();
+	return 0;
+}
+
+/*
+ * sends the events of the source that are sent on every fix
+ */
+static void event_fix(struct source *src)
+{
+	struct period *p;
+
+	p = period_of(src, PERIOD_ON_FIX);
+	if (p != NULL) {
+		event_send(p);
+		if (p->events == NULL)
+			period_free(p);
+	}
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: RECORDING OF STREAMS                                               **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * returns the current time in us (CLOCK_MONOTONIC), not the one of the
+ * event loop, for recording the reads accurately
+ */
+static uint64_t record_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/*
+ * stops the recording of the source
+ */
+static void record_stop(struct source *src)
+{
+	if (src->recfd >= 0) {
+		close(src->recfd);
+		src->recfd = -1;
+		NOTICE(afbitf, "recording of %s stopped", src->name);
+	}
+}
+
+/*
+ * starts the recording of the source in the file of 'path'
+ * (see af-gps-record.h for the format)
+ */
+static int record_start(struct source *src, const char *path)
+{
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (write(fd, GPS_RECORD_MAGIC, GPS_RECORD_MAGIC_LENGTH) != GPS_RECORD_MAGIC_LENGTH) {
+		close(fd);
+		return -1;
+	}
+	record_stop(src);
+	src->recfd = fd;
+	src->recstart = record_now();
+	NOTICE(afbitf, "recording of %s started in %s", src->name, path);
+	return 0;
+}
+
+/*
+ * records the chunk of 'length' bytes read at 'data'
+ */
+static void record_write(struct source *src, const char *data, uint32_t length)
+{
+	uint8_t header[GPS_RECORD_HEADER];
+	struct iovec iov[2];
+
+	put_u64(&header[0], record_now() - src->recstart);
+	put_u32(&header[8], length);
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof header;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = length;
+	if (writev(src->recfd, iov, 2) != (ssize_t)(sizeof header + length)) {
+		ERROR(afbitf, "can't record %s: %m", src->name);
+		record_stop(src);
+	}
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: HANDLING NMEA                                                      **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * interprets a nmea time
+ */
+static int nmea_time(const char *text, uint32_t *result)
+{
+	uint32_t x;
+
+	if (text[0] < '0' || text[0] > '2'
+	 || text[1] < '0' || text[1] > (text[0] == '2' ? '3' : '9')
+	 || text[2] < '0' || text[2] > '5'
+	 || text[3] < '0' || text[3] > '9'
+	 || text[4] < '0' || text[4] > '5'
+	 || text[5] < '0' || text[5] > '9'
+	 || (text[6] != 0 && text[6] != '.'))
+		return 0;
+
+	x = (uint32_t)(text[0] - '0');
+	x = x * 10 + (uint32_t)(text[1]-'0');
+	x = x *  6 + (uint32_t)(text[2]-'0');
+	x = x * 10 + (uint32_t)(text[3]-'0');
+	x = x *  6 + (uint32_t)(text[4]-'0');
+	x = x * 10 + (uint32_t)(text[5]-'0');
+	x = x * 1000;
+	if (text[6] == '.') {
+		if (text[7] != 0) {
+			if (text[7] < '0' || text[7] > '9') return 0;
+			x += (uint32_t)(text[7]-'0') * 100;
+			if (text[8] != 0) {
+				if (text[8] < '0' || text[8] > '9') return 0;
+				x += (uint32_t)(text[8]-'0') * 10;
+				if (text[9] != 0) {
+					if (text[9] < '0' || text[9] > '9') return 0;
+					x += (uint32_t)(text[9]-'0');
+					if (text[10] != 0) {
+						if (text[10] < '0' || text[10] > '9') return 0;
+						x += text[10] > '5';
+					}
+				}
+			}
+		}
+	}
+
+	*result = x;
+	return 1;
+}
+
+/*
+ * interprets a decimal number as a fixed point integer having 'scale'
+ * decimal digits: "-12.3456" gives -123456 for a scale of 4
+ * and -1234560 for a scale of 5. Extra decimal digits are truncated.
+ * returns 1 if correct or 0 if a format error exists
+ */
+static int nmea_fixed(const char *text, int scale, int64_t *result)
+{
+	int64_t x = 0;
+	int neg, digits = 0;
+
+	neg = *text == '-';
+	text += neg;
+	while (*text >= '0' && *text <= '9') {
+		if (++digits > 11)
+			return 0;
+		x = x * 10 + (*text++ - '0');
+	}
+	if (*text == '.') {
+		while (*++text >= '0' && *text <= '9') {
+			if (scale > 0) {
+				x = x * 10 + (*text - '0');
+				scale--;
+			}
+			digits++;
+		}
+	}
+	if (*text || !digits)
+		return 0;
+	while (scale-- > 0)
+		x *= 10;
+
+	*result = neg ? -x : x;
+	return 1;
+}
+
+/*
+ * interprets a nmea angle having minutes: DDDMM.mmmmmmm
+ * not greater than 'max' degrees (90 for latitudes, 180 for longitudes)
+ *
+ * The angle is computed in 1e-7 minute (about 0.2 mm) units and then
+ * converted to degrees.
+ */
+static int nmea_angle(const char *text, int max, double *result)
+{
+	int64_t x, deg, min;
+
+	if (!nmea_fixed(text, 7, &x) || x < 0)
+		return 0;
+
+	deg = x / 1000000000;	/* 100 minutes of 1e7 */
+	min = x % 1000000000;
+	if (min >= 600000000 || deg * 600000000 + min > (int64_t)max * 600000000)
+		return 0;
+
+	*result = (double)(deg * 600000000 + min) * (1.0 / 600000000);
+
+	return 1;
+}
+
+/*
+ * interprets a nmea decimal value having at most 3 decimal digits
+ */
+static int nmea_decimal(const char *text, double *result)
+{
+	int64_t x;
+
+	if (!nmea_fixed(text, 3, &x))
+		return 0;
+
+	*result = (double)x * 0.001;
+	return 1;
+}
+
+/*
+ * interprets a nmea unsigned integer
+ */
+static int nmea_uint(const char *text, uint32_t *result)
+{
+	uint32_t x = 0;
+	int digits = 0;
+
+	while (*text >= '0' && *text <= '9') {
+		if (++digits > 9)
+			return 0;
+		x = x * 10 + (uint32_t)(*text++ - '0');
+	}
+	if (*text || !digits)
+		return 0;
+
+	*result = x;
+	return 1;
+}
+
+/*
+ * interprets a nmea date DDMMYY as YYYYMMDD
+ */
+static int nmea_date(const char *text, uint32_t *result)
+{
+	uint32_t x, day, month, year;
+
+	if (strlen(text) != 6 || !nmea_uint(text, &x))
+		return 0;
+
+	day = x / 10000;
+	month = x / 100 % 100;
+	year = x % 100;
+	if (day < 1 || day > 31 || month < 1 || month > 12)
+		return 0;
+
+	*result = ((year < 80 ? 2000 : 1900) + year) * 10000 + month * 100 + day;
+	return 1;
+}
+
+/*
+ * fills gps for the given optionnal fields
+ * returns 1 if correct or 0 if a format error exists
+ */
+static int nmea_set(
+		struct gps *gps,
+		const char *tim,
+		const char *lat, const char *latu,
 		const char *lon, const char *lonu,
 		const char *alt, const char *altu,
 		const char *spe,
@@ -575,313 +1903,1654 @@ static int nmea_set(
 		const char *dat
 )
 {
-	struct gps gps;
+	DEBUG(afbitf, "time=%s latitude=%s%s longitude=%s%s altitude=%s%s speed=%s track=%s date=%s",
+		tim, lat, latu, lon, lonu, alt, altu, spe, tra, dat);
+
+	/* get the time in milliseconds */
+	if (tim == NULL)
+		gps->set.time = 0;
+	else {
+		if (!nmea_time(tim, &gps->time))
+			return 0;
+		gps->set.time = 1;
+	}
+
+	/* get the latitude */
+	if (lat == NULL || latu == NULL || !*lat)
+		gps->set.latitude = 0;
+	else {
+		if ((latu[0] != 'N' && latu[0] != 'S') || latu[1] != 0)
+			return 0;
+		if (!nmea_angle(lat, 90, &gps->latitude))
+			return 0;
+		if (latu[0] == 'S')
+			gps->latitude = -gps->latitude;
+		gps->set.latitude = 1;
+	}
+
+	/* get the longitude */
+	if (lon == NULL || lonu == NULL || !*lon)
+		gps->set.longitude = 0;
+	else {
+		if ((lonu[0] != 'E' && lonu[0] != 'W') || lonu[1] != 0)
+			return 0;
+		if (!nmea_angle(lon, 180, &gps->longitude))
+			return 0;
+		if (lonu[0] == 'W')
+			gps->longitude = 360.0 - gps->longitude;
+		gps->set.longitude = 1;
+	}
+
+	/* get the altitude */
+	if (alt == NULL || altu == NULL || !*alt)
+		gps->set.altitude = 0;
+	else {
+		if (altu[0] != 'M' || altu[1] != 0)
+			return 0;
+		if (!nmea_decimal(alt, &gps->altitude))
+			return 0;
+		gps->set.altitude = 1;
+	}
+
+	/* get the speed */
+	if (spe == NULL || !*spe)
+		gps->set.speed = 0;
+	else {
+		if (!nmea_decimal(spe, &gps->speed))
+			return 0;
+		gps->speed *= KNOT_TO_METER_PER_SECOND;
+		gps->set.speed = 1;
+	}
+
+	/* get the track */
+	if (tra == NULL || !*tra)
+		gps->set.track = 0;
+	else {
+		if (!nmea_decimal(tra, &gps->track))
+			return 0;
+		gps->set.track = 1;
+	}
+
+	/* get the date */
+	if (dat == NULL || !*dat)
+		gps->set.date = 0;
+	else {
+		if (!nmea_date(dat, &gps->date))
+			return 0;
+		gps->set.date = 1;
+	}
+
+	return 1;
+}
+
+/*
+ * copies the fields set in 'from' to 'to'
+ */
+static void gps_merge(struct gps *to, const struct gps *from)
+{
+	if (from->set.time) {
+		to->time = from->time;
+		to->set.time = 1;
+	}
+	if (from->set.latitude) {
+		to->latitude = from->latitude;
+		to->set.latitude = 1;
+	}
+	if (from->set.longitude) {
+		to->longitude = from->longitude;
+		to->set.longitude = 1;
+	}
+	if (from->set.altitude) {
+		to->altitude = from->altitude;
+		to->set.altitude = 1;
+	}
+	if (from->set.speed) {
+		to->speed = from->speed;
+		to->set.speed = 1;
+	}
+	if (from->set.track) {
+		to->track = from->track;
+		to->set.track = 1;
+	}
+	if (from->set.date) {
+		to->date = from->date;
+		to->set.date = 1;
+	}
+	if (from->set.fix) {
+		to->fix = from->fix;
+		to->set.fix = 1;
+	}
+	if (from->set.used) {
+		to->used = from->used;
+		to->set.used = 1;
+	}
+	if (from->set.inview) {
+		to->inview = from->inview;
+		to->set.inview = 1;
+	}
+	if (from->set.pdop) {
+		to->pdop = from->pdop;
+		to->set.pdop = 1;
+	}
+	if (from->set.hdop) {
+		to->hdop = from->hdop;
+		to->set.hdop = 1;
+	}
+	if (from->set.vdop) {
+		to->vdop = from->vdop;
+		to->set.vdop = 1;
+	}
+	if (from->set.herr) {
+		to->herr = from->herr;
+		to->set.herr = 1;
+	}
+	if (from->set.verr) {
+		to->verr = from->verr;
+		to->set.verr = 1;
+	}
+}
+
+/*
+ * records for the source the data of one sentence
+ *
+ * The sentences of the same epoch (same time or no time) are merged
+ * in the current frame. Sentences of a new epoch start a new frame.
+ */
+static int nmea_push(struct source *src, struct gps *gps)
+{
+	struct history *h = &src->history;
+	struct gps *last;
+	int push;
+
+	last = &h->slots[(h->count - 1) & h->mask].gps;
+	push = h->count == 0 || (gps->set.time && (!last->set.time || last->time != gps->time));
+	last = history_write_begin(h, push);
+	if (push) {
+		/* push the frame */
+		*last = *gps;
+	} else {
+		/* complete the frame */
+		gps_merge(last, gps);
+	}
+	history_write_end(h);
+	src->newframes++;
+	src->seq++;
+
+	DEBUG(afbitf, "time:%d=%d latitude:%d=%g longitude:%d=%g altitude:%d=%g speed:%d=%g track:%d=%g",
+		(int)last->set.time, last->set.time ? (int)last->time : 0,
+		(int)last->set.latitude, last->set.latitude ? last->latitude : 0,
+		(int)last->set.longitude, last->set.longitude ? last->longitude : 0,
+		(int)last->set.altitude, last->set.altitude ? last->altitude : 0,
+		(int)last->set.speed, last->set.speed ? last->speed : 0,
+		(int)last->set.track, last->set.track ? last->track : 0
+	);
+
+	return 1;
+}
+
+/*
+ * interprete one sentence GGA - Fix information
+ *
+ * only the 10 first fields, up to the altitude, are read: the trailing
+ * fields of geoid and differential data are omitted by some receivers
+ */
+static int nmea_gga(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+	uint32_t used;
+
+	if (count < 10 || *f[5] == '0'
+	 || !nmea_set(&gps, f[0], f[1], f[2], f[3], f[4], f[8], f[9], NULL, NULL, NULL))
+		return 0;
+
+	/* satellites used and horizontal dilution */
+	if (*f[6]) {
+		if (!nmea_uint(f[6], &used) || used > 255)
+			return 0;
+		gps.used = (uint8_t)used;
+		gps.set.used = 1;
+	}
+	if (*f[7]) {
+		if (!nmea_decimal(f[7], &gps.hdop))
+			return 0;
+		gps.set.hdop = 1;
+	}
+
+	return nmea_push(src, &gps);
+}
+
+/*
+ * interprete one sentence RMC - Recommended Minimum
+ *
+ * it has 11 fields before NMEA 2.3, that added the mode, and 13 since
+ * NMEA 4.1, that added the navigational status: only the 9 first are read
+ */
+static int nmea_rmc(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+
+	return count >= 11
+		&& *f[1] == 'A'
+		&& nmea_set(&gps, f[0], f[2], f[3], f[4], f[5], NULL, NULL, f[6], f[7], f[8])
+		&& nmea_push(src, &gps);
+}
+
+/*
+ * interprete one sentence GSA - DOP and active satellites
+ */
+static int nmea_gsa(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+	int i;
+
+	if (count < 17 || f[1][0] < '1' || f[1][0] > '3' || f[1][1])
+		return 0;
+
+	gps.fix = (uint8_t)(f[1][0] - '0');
+	gps.set.fix = 1;
+	if (gps.fix == 1)
+		return nmea_push(src, &gps);
+
+	/* count the satellites used */
+	for (i = 2 ; i < 14 ; i++)
+		gps.used = (uint8_t)(gps.used + (*f[i] != 0));
+	gps.set.used = 1;
+
+	/* dilutions of precision */
+	if (*f[14]) {
+		if (!nmea_decimal(f[14], &gps.pdop))
+			return 0;
+		gps.set.pdop = 1;
+	}
+	if (*f[15]) {
+		if (!nmea_decimal(f[15], &gps.hdop))
+			return 0;
+		gps.set.hdop = 1;
+	}
+	if (*f[16]) {
+		if (!nmea_decimal(f[16], &gps.vdop))
+			return 0;
+		gps.set.vdop = 1;
+	}
+
+	return nmea_push(src, &gps);
+}
+
+/*
+ * interprete one sentence GSV - Satellites in view
+ *
+ * only the count of satellites in view is recorded
+ */
+static int nmea_gsv(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+	uint32_t inview;
+
+	if (count < 3 || !nmea_uint(f[2], &inview) || inview > 255)
+		return 0;
+
+	gps.inview = (uint8_t)inview;
+	gps.set.inview = 1;
+	return nmea_push(src, &gps);
+}
+
+/*
+ * interprete one sentence VTG - Track made good and ground speed
+ */
+static int nmea_vtg(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+
+	return count >= 8
+		&& (count == 8 || *f[8] != 'N')
+		&& nmea_set(&gps, NULL, NULL, NULL, NULL, NULL, NULL, NULL, f[4], f[0], NULL)
+		&& nmea_push(src, &gps);
+}
+
+/*
+ * interprete one sentence GLL - Geographic position
+ */
+static int nmea_gll(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+
+	return count >= 6
+		&& *f[5] == 'A'
+		&& nmea_set(&gps, f[4], f[0], f[1], f[2], f[3], NULL, NULL, NULL, NULL, NULL)
+		&& nmea_push(src, &gps);
+}
+
+/*
+ * interprete one sentence ZDA - Time and date
+ */
+static int nmea_zda(struct source *src, char *f[], int count)
+{
+	struct gps gps = { .set = { 0 } };
+	uint32_t day, month, year;
+
+	if (count != 6
+	 || !nmea_set(&gps, f[0], NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL)
+	 || !nmea_uint(f[1], &day) || day < 1 || day > 31
+	 || !nmea_uint(f[2], &month) || month < 1 || month > 12
+	 || !nmea_uint(f[3], &year) || year > 9999)
+		return 0;
+
+	gps.date = year * 10000 + month * 100 + day;
+	gps.set.date = 1;
+	return nmea_push(src, &gps);
+}
+
+/*
+ * packs the 3 letters of a sentence identifier
+ */
+#define NMEA_ID(a,b,c)  ((uint32_t)(uint8_t)(a) << 16 | (uint32_t)(uint8_t)(b) << 8 | (uint32_t)(uint8_t)(c))
+
+/*
+ * interprete one NMEA sentence of the source given by its fields,
+ * the first field being the talker and sentence identifier
+ */
+static int nmea_sentence(struct source *src, char *fields[], int count)
+{
+	const char *s = fields[0];
+
+	if (!s[0] || !s[1] || !s[2] || !s[3] || !s[4] || s[5])
+		return 0;
+
+	switch (NMEA_ID(s[2], s[3], s[4])) {
+	case NMEA_ID('G','G','A'): return nmea_gga(src, &fields[1], count - 1);
+	case NMEA_ID('R','M','C'): return nmea_rmc(src, &fields[1], count - 1);
+	case NMEA_ID('G','S','A'): return nmea_gsa(src, &fields[1], count - 1);
+	case NMEA_ID('G','S','V'): return nmea_gsv(src, &fields[1], count - 1);
+	case NMEA_ID('V','T','G'): return nmea_vtg(src, &fields[1], count - 1);
+	case NMEA_ID('G','L','L'): return nmea_gll(src, &fields[1], count - 1);
+	case NMEA_ID('Z','D','A'): return nmea_zda(src, &fields[1], count - 1);
+	default: return 0;
+	}
+}
+
+/*
+ * Scanners of the delimiters of the NMEA stream
+ *
+ * A scanner searches the end of line in the bytes from 'begin' to 'end'
+ * and records in 'split' the offsets from 'base' of the commas found
+ * on its way. It also accumulates in 'split' the exclusive or of the
+ * bytes before the end of line for checking the checksum without
+ * an other pass. It returns the pointer to the end of line or NULL when
+ * no end of line is found. In that later case, the scan is continued
+ * by the next call with the same base and split.
+ *
+ * Vectorized versions are selected at runtime by 'nmea_scan_init'.
+ * They never read beyond 'end', the remaining bytes being processed
+ * by the scalar version.
+ */
+typedef const char *(*nmea_scanner_t)(const char *base, const char *begin, const char *end, struct split *split);
+
+/*
+ * records the comma at offset
+ */
+static inline void split_add(struct split *split, uint32_t offset)
+{
+	if (split->count < NMEA_MAX_FIELDS - 1)
+		split->commas[split->count] = (uint16_t)offset;
+	split->count++;
+}
+
+/*
+ * resets the split for a new sentence
+ */
+static inline void split_reset(struct split *split)
+{
+	split->count = 0;
+	split->sum = 0;
+}
+
+/*
+ * records the commas of the bit mask 'commas' for bytes at 'p'
+ */
+static inline void split_add_mask(struct split *split, const char *base, const char *p, uint32_t commas)
+{
+	while (commas) {
+		split_add(split, (uint32_t)(p - base) + (uint32_t)__builtin_ctz(commas));
+		commas &= commas - 1;
+	}
+}
+
+/*
+ * scalar scanner
+ */
+static const char *nmea_scan_scalar(const char *base, const char *begin, const char *end, struct split *split)
+{
+	while (begin != end) {
+		if (*begin == '\n')
+			return begin;
+		if (*begin == ',')
+			split_add(split, (uint32_t)(begin - base));
+		split->sum ^= (uint8_t)*begin;
+		begin++;
+	}
+	return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * SSE2 scanner, 16 bytes at a time
+ */
+__attribute__((target("sse2")))
+static const char *nmea_scan_sse2(const char *base, const char *begin, const char *end, struct split *split)
+{
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i eol = _mm_set1_epi8('\n');
+	const __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i v, sum = _mm_setzero_si128();
+	uint32_t mc, me, n;
+	const char *result = NULL;
+
+	while (end - begin >= 16) {
+		v = _mm_loadu_si128((const __m128i*)begin);
+		mc = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+		me = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, eol));
+		if (me) {
+			/* keep only the commas and the bytes before the end of line */
+			n = (uint32_t)__builtin_ctz(me);
+			split_add_mask(split, base, begin, mc & ((me & -me) - 1));
+			sum = _mm_xor_si128(sum, _mm_and_si128(v, _mm_cmplt_epi8(index, _mm_set1_epi8((char)n))));
+			result = begin + n;
+			break;
+		}
+		split_add_mask(split, base, begin, mc);
+		sum = _mm_xor_si128(sum, v);
+		begin += 16;
+	}
+
+	/* reduce the exclusive or */
+	sum = _mm_xor_si128(sum, _mm_srli_si128(sum, 8));
+	sum = _mm_xor_si128(sum, _mm_srli_si128(sum, 4));
+	sum = _mm_xor_si128(sum, _mm_srli_si128(sum, 2));
+	sum = _mm_xor_si128(sum, _mm_srli_si128(sum, 1));
+	split->sum ^= (uint8_t)_mm_cvtsi128_si32(sum);
+
+	return result ? : nmea_scan_scalar(base, begin, end, split);
+}
+
+/*
+ * AVX2 scanner, 32 bytes at a time
+ */
+__attribute__((target("avx2")))
+static const char *nmea_scan_avx2(const char *base, const char *begin, const char *end, struct split *split)
+{
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i eol = _mm256_set1_epi8('\n');
+	const __m256i index = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+			16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+	__m256i v, sum = _mm256_setzero_si256();
+	__m128i s;
+	uint32_t mc, me, n;
+	const char *result = NULL;
+
+	while (end - begin >= 32) {
+		v = _mm256_loadu_si256((const __m256i*)begin);
+		mc = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma));
+		me = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, eol));
+		if (me) {
+			/* keep only the commas and the bytes before the end of line */
+			n = (uint32_t)__builtin_ctz(me);
+			split_add_mask(split, base, begin, mc & ((me & -me) - 1));
+			sum = _mm256_xor_si256(sum, _mm256_and_si256(v, _mm256_cmpgt_epi8(_mm256_set1_epi8((char)n), index)));
+			result = begin + n;
+			break;
+		}
+		split_add_mask(split, base, begin, mc);
+		sum = _mm256_xor_si256(sum, v);
+		begin += 32;
+	}
+
+	/* reduce the exclusive or */
+	s = _mm_xor_si128(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	s = _mm_xor_si128(s, _mm_srli_si128(s, 8));
+	s = _mm_xor_si128(s, _mm_srli_si128(s, 4));
+	s = _mm_xor_si128(s, _mm_srli_si128(s, 2));
+	s = _mm_xor_si128(s, _mm_srli_si128(s, 1));
+	split->sum ^= (uint8_t)_mm_cvtsi128_si32(s);
+
+	return result ? : nmea_scan_sse2(base, begin, end, split);
+}
+#endif
+
+/* the scanner in use */
+static nmea_scanner_t nmea_scan = nmea_scan_scalar;
+
+/*
+ * selects the best scanner for the running processor
+ */
+static void nmea_scan_init()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		nmea_scan = nmea_scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		nmea_scan = nmea_scan_sse2;
+#endif
+}
 
-	DEBUG(afbitf, "time=%s latitude=%s%s longitude=%s%s altitude=%s%s speed=%s track=%s date=%s",
-		tim, lat, latu, lon, lonu, alt, altu, spe, tra, dat);
+/*
+ * Initialises the ring buffer of the NMEA stream
+ *
+ * The memory of the ring is mapped twice, contiguously, so that
+ * any sequence of bytes of the ring, even when it wraps around its
+ * end, is seen as a contiguous string. It allows to read and to
+ * scan the sentences in place without ever moving received bytes.
+ *
+ * The mappings needing whole pages, the size is RING_SIZE rounded up
+ * to the size of the pages, 16K or 64K on some arm64 kernels.
+ */
+static int ring_init(struct ring *ring)
+{
+	int fd;
+	long pagesz;
+	size_t size;
+	char *base;
 
-	/* get the time in milliseconds */
-	if (tim == NULL)
-		gps.set.time = 0;
-	else {
-		if (!nmea_time(tim, &gps.time))
-			return 0;
-		gps.set.time = 1;
+	pagesz = sysconf(_SC_PAGESIZE);
+	if (pagesz <= 0)
+		return -1;
+	size = (RING_SIZE + (size_t)pagesz - 1) / (size_t)pagesz * (size_t)pagesz;
+	if ((size & (size - 1)) != 0 || size > UINT32_MAX / 2)
+		return -1;
+
+	fd = memfd_create("afb-gps-ring", MFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, (off_t)size) < 0)
+		goto error;
+
+	/* reserve the address space then maps the memory twice */
+	base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		goto error;
+	if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+	 || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, 2 * size);
+		goto error;
 	}
+	close(fd);
 
-	/* get the latitude */
-	if (lat == NULL || latu == NULL)
-		gps.set.latitude = 0;
-	else {
-		if ((latu[0] != 'N' && latu[0] != 'S') || latu[1] != 0)
-			return 0;
-		if (!nmea_angle(lat, &gps.latitude))
+	ring->base = base;
+	ring->size = (uint32_t)size;
+	ring->mask = (uint32_t)size - 1;
+	ring->head = ring->tail = ring->scan = 0;
+	ring->overflow = 0;
+	ring->sentences = 0;
+	ring->checksum_errors = 0;
+	ring->too_long = 0;
+	ring->malformed = 0;
+	split_reset(&ring->split);
+	return 0;
+
+error:
+	close(fd);
+	return -1;
+}
+
+/*
+ * value of the hexadecimal digit c or -1 if invalid
+ */
+static inline int hexval(char c)
+{
+	return c >= '0' && c <= '9' ? c - '0'
+		: c >= 'A' && c <= 'F' ? c - 'A' + 10
+		: c >= 'a' && c <= 'f' ? c - 'a' + 10
+		: -1;
+}
+
+/*
+ * checks the checksum of the sentence of 'len' bytes terminated
+ * by *hh\r, 'sum' being the exclusive or of all its bytes
+ *
+ * as the exclusive or is its own inverse, the bytes '$', '*', 'h', 'h'
+ * and '\r' are removed from 'sum' to get the checksum of the body
+ */
+static int nmea_checksum(const char *sentence, uint32_t len, uint8_t sum)
+{
+	int hi, lo;
+
+	hi = hexval(sentence[len-3]);
+	lo = hexval(sentence[len-2]);
+	if (hi < 0 || lo < 0)
+		return 0;
+
+	sum ^= (uint8_t)(sentence[0] ^ sentence[len-4] ^ sentence[len-3] ^ sentence[len-2] ^ sentence[len-1]);
+	return sum == ((hi << 4) | lo);
+}
+
+/*
+ * Processes the complete sentences available in the ring of the source
+ */
+static void ring_scan(struct source *src)
+{
+	struct ring *ring = &src->ring;
+	char *head, *end, *tail, *eol;
+	char *fields[NMEA_MAX_FIELDS];
+	uint32_t pos, len, i, count;
+
+	while (ring->scan != ring->head) {
+		/* search the end of the line */
+		tail = &ring->base[ring->tail & ring->mask];
+		head = &tail[ring->scan - ring->tail];
+		end = &tail[ring->head - ring->tail];
+		eol = (char*)nmea_scan(tail, head, end, &ring->split);
+		if (eol == NULL) {
+			/* incomplete sentence */
+			ring->scan = ring->head;
+			if (ring->head - ring->tail > NMEA_MAX_LENGTH) {
+				/* too long, drop it until its end */
+				ring->overflow = 1;
+				ring->tail = ring->head;
+				split_reset(&ring->split);
+			}
+			return;
+		}
+
+		/* process the sentence in place */
+		len = (uint32_t)(eol - tail);
+		count = ring->split.count + 1;
+		if (ring->overflow || len > NMEA_MAX_LENGTH)
+			ring->too_long++;
+		else if (tail[0] == '$' && len > 0 && tail[len-1] == '\r' && count <= NMEA_MAX_FIELDS) {
+			if (len > 3 && tail[len-4] == '*') {
+				/* check the checksum */
+				if (!nmea_checksum(tail, len, ring->split.sum)) {
+					ring->checksum_errors++;
+					goto next;
+				}
+				tail[len-4] = 0;
+			} else {
+				tail[len-1] = 0;
+			}
+			ring->sentences++;
+			fields[0] = &tail[1];
+			for (i = 1 ; i < count ; i++) {
+				pos = ring->split.commas[i - 1];
+				tail[pos] = 0;
+				fields[i] = &tail[pos + 1];
+			}
+			nmea_sentence(src, fields, (int)count);
+		}
+
+next:
+		/* next sentence */
+		pos = ring->tail + len + 1;
+		ring->tail = ring->scan = pos;
+		ring->overflow = 0;
+		split_reset(&ring->split);
+	}
+}
+
+/*
+ * reads the NMEA stream or the gpsd reports
+ *
+ * Each read fills all the free space of the ring so that
+ * bursts of sentences are got with only one system call.
+ */
+static int nmea_read(struct source *src, int fd)
+{
+	struct ring *ring = &src->ring;
+	struct stats *stats = src->stats;
+	uint64_t start;
+	int rc;
+
+	for(;;) {
+		rc = (int)read(fd, &ring->base[ring->head & ring->mask], ring->size - (ring->head - ring->tail));
+		if (rc < 0) {
+			/* its an error if not interrupted */
+			if (errno != EINTR)
+				return rc;
+		} else if (rc == 0) {
+			/* nothing more to be read */
 			return 0;
-		if (latu[0] == 'S')
-			gps.latitude = -gps.latitude;
-		gps.set.latitude = 1;
+		} else {
+			/* scan the received sentences or reports */
+			if (src->recfd >= 0)
+				record_write(src, &ring->base[ring->head & ring->mask], (uint32_t)rc);
+			ring->head += (uint32_t)rc;
+			stats->reads++;
+			stats->bytes += (uint64_t)rc;
+			histo_add(&stats->read, (uint64_t)rc);
+			start = stats_now_ns();
+			src->scan(src);
+			histo_add(&stats->scan, stats_now_ns() - start);
+		}
 	}
+}
 
-	/* get the longitude */
-	if (lon == NULL || lonu == NULL)
-		gps.set.longitude = 0;
-	else {
-		if ((lonu[0] != 'E' && lonu[0] != 'W') || lonu[1] != 0)
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: HANDLING GPSD JSON REPORTS                                         **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/*
+ * cursor of the reader of a JSON report
+ *
+ * The report is read in place in one pass, without building objects:
+ * only the members of interest are converted, the others are skipped.
+ * Strings are terminated in place and are not unescaped.
+ */
+struct jscan {
+	char *p;		/* current position */
+	char *end;		/* end of the report */
+};
+
+/*
+ * skips the spaces
+ */
+static void js_space(struct jscan *js)
+{
+	while (js->p < js->end && (*js->p == ' ' || *js->p == '\t' || *js->p == '\r'))
+		js->p++;
+}
+
+/*
+ * skips the spaces and reads the char 'c' if it is the next one
+ */
+static int js_char(struct jscan *js, char c)
+{
+	js_space(js);
+	if (js->p == js->end || *js->p != c)
+		return 0;
+	js->p++;
+	return 1;
+}
+
+/*
+ * reads a string and terminates it in place
+ */
+static int js_string(struct jscan *js, char **str)
+{
+	char *p;
+
+	if (!js_char(js, '"'))
+		return 0;
+	for (p = js->p ; p < js->end && *p != '"' ; p++)
+		if (*p == '\\')
+			p++;
+	if (p >= js->end)
+		return 0;
+	*str = js->p;
+	*p = 0;
+	js->p = p + 1;
+	return 1;
+}
+
+/*
+ * reads a number
+ */
+static int js_number(struct jscan *js, double *value)
+{
+	char *end;
+
+	js_space(js);
+	*value = strtod(js->p, &end);
+	if (end == js->p || end > js->end)
+		return 0;
+	js->p = end;
+	return 1;
+}
+
+/*
+ * reads the literal 'word'
+ */
+static int js_literal(struct jscan *js, const char *word)
+{
+	size_t len = strlen(word);
+
+	js_space(js);
+	if ((size_t)(js->end - js->p) < len || memcmp(js->p, word, len))
+		return 0;
+	js->p += len;
+	return 1;
+}
+
+/*
+ * skips a value of any kind
+ */
+static int js_skip(struct jscan *js)
+{
+	char *str, *start;
+	int depth = 0;
+
+	do {
+		js_space(js);
+		if (js->p == js->end)
 			return 0;
-		if (!nmea_angle(lon, &gps.longitude))
+		switch (*js->p) {
+		case '"':
+			if (!js_string(js, &str))
+				return 0;
+			break;
+		case '{':
+		case '[':
+			depth++;
+			js->p++;
+			break;
+		case '}':
+		case ']':
+			if (--depth < 0)
+				return 0;
+			js->p++;
+			break;
+		case ',':
+		case ':':
+			if (depth == 0)
+				return 0;
+			js->p++;
+			break;
+		default:
+			/* number or literal, ended by a delimiter, failing
+			 * without progress as on a NUL that strchr matches */
+			start = js->p;
+			while (js->p < js->end && *js->p && !strchr(",:]} \t\r", *js->p))
+				js->p++;
+			if (js->p == start)
+				return 0;
+			break;
+		}
+	} while (depth > 0);
+	return 1;
+}
+
+/*
+ * reads a number into the 'field' of 'gps' and sets its flag
+ */
+#define JS_FIELD(js,gps,field) \
+	(js_number(js, &(gps)->field) ? ((gps)->set.field = 1) : 0)
+
+/*
+ * interprets the ISO 8601 time of gpsd: YYYY-MM-DDTHH:MM:SS[.sss]Z
+ */
+static int gpsd_time(const char *text, struct gps *gps)
+{
+	char hms[11];
+	int i;
+
+	for (i = 0 ; i < 19 ; i++)
+		if (i == 4 || i == 7 ? text[i] != '-'
+		  : i == 10 ? text[i] != 'T'
+		  : i == 13 || i == 16 ? text[i] != ':'
+		  : (text[i] < '0' || text[i] > '9'))
+			return 0;
+
+	/* the time, reformatted for nmea_time */
+	memcpy(hms, &text[11], 2);
+	memcpy(&hms[2], &text[14], 2);
+	memcpy(&hms[4], &text[17], 2);
+	for (i = 6 ; i < 10 && (text[13 + i] == '.' || (text[13 + i] >= '0' && text[13 + i] <= '9')) ; i++)
+		hms[i] = text[13 + i];
+	hms[i] = 0;
+	if (!nmea_time(hms, &gps->time))
+		return 0;
+
+	/* the date */
+	gps->date = 0;
+	for (i = 0 ; i < 10 ; i++)
+		if (i != 4 && i != 7)
+			gps->date = gps->date * 10 + (uint32_t)(text[i] - '0');
+	gps->set.time = gps->set.date = 1;
+	return 1;
+}
+
+/*
+ * reads the array of satellites of a SKY report
+ */
+static int gpsd_satellites(struct jscan *js, struct gps *gps)
+{
+	char *key;
+	uint32_t inview = 0, used = 0;
+
+	if (!js_char(js, '['))
+		return 0;
+	if (!js_char(js, ']')) {
+		do {
+			if (!js_char(js, '{'))
+				return 0;
+			inview++;
+			if (!js_char(js, '}')) {
+				do {
+					if (!js_string(js, &key) || !js_char(js, ':'))
+						return 0;
+					if (!strcmp(key, "used") && js_literal(js, "true"))
+						used++;
+					else if (!js_skip(js))
+						return 0;
+				} while (js_char(js, ','));
+				if (!js_char(js, '}'))
+					return 0;
+			}
+		} while (js_char(js, ','));
+		if (!js_char(js, ']'))
 			return 0;
-		if (lonu[0] == 'W')
-			gps.longitude = 360.0 - gps.longitude;
-		gps.set.longitude = 1;
 	}
+	gps->inview = (uint8_t)(inview > 255 ? 255 : inview);
+	gps->used = (uint8_t)(used > 255 ? 255 : used);
+	gps->set.inview = gps->set.used = 1;
+	return 1;
+}
 
-	/* get the altitude */
-	if (alt == NULL || altu == NULL)
-		gps.set.altitude = 0;
-	else {
-		if (altu[0] != 'M' || altu[1] != 0)
+/*
+ * interprets one report of gpsd, only TPV and SKY are recorded
+ */
+static int gpsd_report(struct source *src, char *line, uint32_t len)
+{
+	struct jscan js = { .p = line, .end = line + len };
+	struct gps gps;
+	char *key, *str;
+	double value, epx = -1, epy = -1;
+	int tpv = 0, sky = 0;
+
+	memset(&gps, 0, sizeof gps);
+	if (!js_char(&js, '{'))
+		return 0;
+	if (!js_char(&js, '}')) {
+		do {
+			if (!js_string(&js, &key) || !js_char(&js, ':'))
+				return 0;
+			if (!strcmp(key, "class")) {
+				if (!js_string(&js, &str))
+					return 0;
+				tpv = !strcmp(str, "TPV");
+				sky = !strcmp(str, "SKY");
+				if (!tpv && !sky)
+					return 1;
+			} else if (!strcmp(key, "time")) {
+				if (!js_string(&js, &str) || !gpsd_time(str, &gps))
+					return 0;
+			} else if (!strcmp(key, "mode")) {
+				if (!js_number(&js, &value))
+					return 0;
+				if (value >= 1 && value <= 3) {
+					gps.fix = (uint8_t)value;
+					gps.set.fix = 1;
+				}
+			} else if (!strcmp(key, "lat")) {
+				if (!JS_FIELD(&js, &gps, latitude))
+					return 0;
+			} else if (!strcmp(key, "lon")) {
+				if (!JS_FIELD(&js, &gps, longitude))
+					return 0;
+				if (gps.longitude < 0)
+					gps.longitude += 360.0;
+			} else if (!strcmp(key, "alt") || !strcmp(key, "altMSL")) {
+				if (!JS_FIELD(&js, &gps, altitude))
+					return 0;
+			} else if (!strcmp(key, "speed")) {
+				if (!JS_FIELD(&js, &gps, speed))
+					return 0;
+			} else if (!strcmp(key, "track")) {
+				if (!JS_FIELD(&js, &gps, track))
+					return 0;
+			} else if (!strcmp(key, "eph")) {
+				if (!JS_FIELD(&js, &gps, herr))
+					return 0;
+			} else if (!strcmp(key, "epx")) {
+				if (!js_number(&js, &epx))
+					return 0;
+			} else if (!strcmp(key, "epy")) {
+				if (!js_number(&js, &epy))
+					return 0;
+			} else if (!strcmp(key, "epv")) {
+				if (!JS_FIELD(&js, &gps, verr))
+					return 0;
+			} else if (!strcmp(key, "pdop")) {
+				if (!JS_FIELD(&js, &gps, pdop))
+					return 0;
+			} else if (!strcmp(key, "hdop")) {
+				if (!JS_FIELD(&js, &gps, hdop))
+					return 0;
+			} else if (!strcmp(key, "vdop")) {
+				if (!JS_FIELD(&js, &gps, vdop))
+					return 0;
+			} else if (!strcmp(key, "satellites")) {
+				if (!gpsd_satellites(&js, &gps))
+					return 0;
+			} else if (!js_skip(&js))
+				return 0;
+		} while (js_char(&js, ','));
+		if (!js_char(&js, '}'))
 			return 0;
-		gps.altitude = atof(alt);
-		gps.set.altitude = 1;
 	}
+	if (!tpv && !sky)
+		return 1;
 
-	/* get the speed */
-	if (spe == NULL)
-		gps.set.speed = 0;
-	else {
-		gps.speed = atof(spe) * KNOT_TO_METER_PER_SECOND;
-		gps.set.speed = 1;
+	/* the horizontal error from its components when eph is missing */
+	if (!gps.set.herr && epx >= 0 && epy >= 0) {
+		gps.herr = sqrt(epx * epx + epy * epy);
+		gps.set.herr = 1;
 	}
 
-	/* get the track */
-	if (tra != NULL)
-		gps.set.track = 0;
-	else {
-		gps.track = atof(tra);
-		gps.set.track = 1;
+	/* SKY completes the fix of the current TPV */
+	if (sky)
+		gps.set.time = gps.set.date = 0;
+
+	src->ring.sentences++;
+	return nmea_push(src, &gps);
+}
+
+/*
+ * scans the received reports of gpsd, one by line
+ */
+static void gpsd_scan(struct source *src)
+{
+	struct ring *ring = &src->ring;
+	char *tail, *eol;
+	uint32_t len;
+
+	while (ring->scan != ring->head) {
+		/* search the end of the line */
+		tail = &ring->base[ring->tail & ring->mask];
+		eol = memchr(&tail[ring->scan - ring->tail], '\n', ring->head - ring->scan);
+		if (eol == NULL) {
+			/* incomplete report */
+			ring->scan = ring->head;
+			if (ring->head - ring->tail > JSON_MAX_LENGTH) {
+				/* too long, drop it until its end */
+				ring->overflow = 1;
+				ring->tail = ring->head;
+			}
+			return;
+		}
+
+		/* process the report in place */
+		len = (uint32_t)(eol - tail);
+		*eol = 0;
+		if (!ring->overflow && !gpsd_report(src, tail, len))
+			ring->malformed++;
+
+		/* next report */
+		ring->tail = ring->scan = ring->tail + len + 1;
+		ring->overflow = 0;
 	}
+}
+
+/***************************************************************************************/
+/***************************************************************************************/
+/**                                                                                   **/
+/**                                                                                   **/
+/**       SECTION: HANDLING OF CONNECTION                                             **/
+/**                                                                                   **/
+/**                                                                                   **/
+/***************************************************************************************/
+/***************************************************************************************/
+/* declare the connection routines */
+static int connect_to(struct source *src);
+static void connect_next(struct source *src);
+
+/*
+ * called when the time of the next attempt of connection of a source is reached
+ */
+static int on_retry(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	connect_to(userdata);
+	return 0;
+}
 
-	/* push the frame */
-	frameidx = (frameidx ? : (int)(sizeof frames / sizeof *frames)) - 1; 
-	frames[frameidx] = gps;
-	newframes++;
+/*
+ * closes the connection of the source, records the error and schedules
+ * the next attempt after the current delay, doubled for the next time
+ */
+static void connect_retry(struct source *src, const char *error)
+{
+	int rc;
 
-	DEBUG(afbitf, "time:%d=%d latitude:%d=%g longitude:%d=%g altitude:%d=%g speed:%d=%g track:%d=%g",
-		(int)gps.set.time, gps.set.time ? (int)gps.time : 0,
-		(int)gps.set.latitude, gps.set.latitude ? gps.latitude : 0,
-		(int)gps.set.longitude, gps.set.longitude ? gps.longitude : 0,
-		(int)gps.set.altitude, gps.set.altitude ? gps.altitude : 0,
-		(int)gps.set.speed, gps.set.speed ? gps.speed : 0,
-		(int)gps.set.track, gps.set.track ? gps.track : 0
-	);
+	/* release the connection */
+	if (src->evsrc != NULL) {
+		close(sd_event_source_get_io_fd(src->evsrc));
+		sd_event_source_unref(src->evsrc);
+		src->evsrc = NULL;
+	}
+	if (src->gai.ar_result != NULL) {
+		freeaddrinfo(src->gai.ar_result);
+		src->gai.ar_result = NULL;
+	}
+	src->addr = NULL;
+	src->error = error;
+	src->failures++;
+
+	/* schedule the next attempt */
+	ERROR(afbitf, "connection of %s to %s %s failed: %s, retrying in %u ms",
+		src->name, src->host, src->service, error, src->backoff);
+	src->state = state_waiting;
+	src->due = now_us() + (uint64_t)src->backoff * 1000;
+	if (src->retry == NULL) {
+		rc = sd_event_add_time(afb_daemon_get_event_loop(afbitf->daemon), &src->retry,
+				CLOCK_MONOTONIC, src->due, TIMER_ACCURACY, on_retry, src);
+		if (rc < 0) {
+			src->retry = NULL;
+			src->state = state_idle;
+			ERROR(afbitf, "can't create the timer of reconnection of %s: %s", src->name, strerror(-rc));
+		}
+	} else {
+		sd_event_source_set_time(src->retry, src->due);
+		sd_event_source_set_enabled(src->retry, SD_EVENT_ONESHOT);
+	}
+	src->backoff = src->backoff >= RETRY_MAX / 2 ? RETRY_MAX : 2 * src->backoff;
+}
+
+/*
+ * records that the source is connected, its connection being evsrc,
+ * and asks gpsd to watch, retrying later if the request can't be sent
+ */
+static void connected(struct source *src)
+{
+	static const char gpsdsetup[] = "?WATCH={\"enable\":true,\"nmea\":true};\r\n";
+	static const char gpsdjson[] = "?WATCH={\"enable\":true,\"json\":true};\r\n";
+	const char *watch;
+	size_t length;
+	ssize_t rc;
+
+	freeaddrinfo(src->gai.ar_result);
+	src->gai.ar_result = NULL;
+	src->addr = NULL;
+	src->error = NULL;
+	src->state = state_connected;
+	src->connections++;
+	src->ring.tail = src->ring.scan = src->ring.head;
+	src->ring.overflow = 0;
+	split_reset(&src->ring.split);
+	sd_event_source_set_io_events(src->evsrc, EPOLLIN | EPOLLRDHUP);
+	if (src->isjson || src->isgpsd) {
+		watch = src->isjson ? gpsdjson : gpsdsetup;
+		length = src->isjson ? sizeof gpsdjson - 1 : sizeof gpsdsetup - 1;
+		do {
+			rc = send(sd_event_source_get_io_fd(src->evsrc), watch, length, MSG_NOSIGNAL);
+		} while (rc < 0 && errno == EINTR);
+		if (rc < 0) {
+			connect_retry(src, strerror(errno));
+			return;
+		}
+		if ((size_t)rc != length) {
+			/* the request of a fresh connection should fit */
+			connect_retry(src, "short write of the request to gpsd");
+			return;
+		}
+	}
+	NOTICE(afbitf, "Connected %s to %s %s", src->name, src->host, src->service);
+}
+
+/*
+ * called on an event on the connection of a source
+ */
+static int on_event(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+{
+	struct source *src = userdata;
+	uint32_t head;
+	socklen_t len;
+	int err, eof = 0;
+
+	/* completion of the connection */
+	if (src->state == state_connecting) {
+		len = sizeof err;
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+		if (err == 0)
+			connected(src);
+		else {
+			/* try the next address */
+			sd_event_source_unref(s);
+			src->evsrc = NULL;
+			close(fd);
+			src->error = strerror(err);
+			connect_next(src);
+		}
+		return 0;
+	}
+
+	/* read available data and send it to who wants every fix */
+	if ((revents & EPOLLIN) != 0) {
+		head = src->ring.head;
+		eof = nmea_read(src, fd) == 0 || (errno != EAGAIN && errno != EINTR);
+		if (head != src->ring.head)
+			src->backoff = RETRY_MIN;
+		event_fix(src);
+	}
 
-	return 1;
+	/* check if error or hangup */
+	if (eof || (revents & (EPOLLERR|EPOLLRDHUP|EPOLLHUP)) != 0)
+		connect_retry(src, "hangup");
+
+	return 0;
 }
 
 /*
- * Splits the nmea sentences in its fields
+ * starts the connection to the next address of the resolution
+ * or schedules a new attempt when no address remains
  */
-static int nmea_split(char *s, char *fields[], int count)
+static void connect_next(struct source *src)
 {
-	int index = 0;
-	while (*s && index < count) {
-		fields[index++] = s;
-		while (*s && *s != ',')
-			s++;
-		if (*s == ',')
-			*s++ = 0;
+	int fd, rc, pending;
+	struct addrinfo *ai;
+
+	while ((ai = src->addr) != NULL) {
+		src->addr = ai->ai_next;
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0) {
+			src->error = strerror(errno);
+			continue;
+		}
+		rc = connect(fd, ai->ai_addr, ai->ai_addrlen);
+		pending = rc < 0;
+		if (pending && errno != EINPROGRESS) {
+			src->error = strerror(errno);
+			close(fd);
+			continue;
+		}
+		rc = sd_event_add_io(afb_daemon_get_event_loop(afbitf->daemon), &src->evsrc, fd,
+				pending ? EPOLLOUT : EPOLLIN | EPOLLRDHUP, on_event, src);
+		if (rc < 0) {
+			src->evsrc = NULL;
+			src->error = strerror(-rc);
+			close(fd);
+			continue;
+		}
+		if (pending)
+			src->state = state_connecting;
+		else
+			connected(src);
+		return;
 	}
-	return !*s && index == count;
+	connect_retry(src, src->error ? : "no address");
 }
 
 /*
- * interprete one sentence GGA - Fix information
+ * called in a thread of the resolver at the end of the resolution of a source
  */
-static int nmea_gga(char *s)
+static void on_resolved_thread(union sigval sv)
 {
-	char *f[14];
+	struct source *src = sv.sival_ptr;
+	uint64_t one = 1;
+	ssize_t rc;
 
-	return nmea_split(s, f, (int)(sizeof f / sizeof *f))
-		&& *f[5] != '0'
-		&&  nmea_set(f[0], f[1], f[2], f[3], f[4], f[6], f[7], NULL, NULL, NULL);
+	/* EAGAIN means a counter already signaling the event loop */
+	do {
+		rc = write(src->efd, &one, sizeof one);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0 && errno != EAGAIN)
+		ERROR(afbitf, "can't signal the resolution of %s: %m", src->name);
 }
 
 /*
- * interprete one sentence RMC - Recommended Minimum
+ * called in the event loop at the end of the resolution of a source
  */
-static int nmea_rmc(char *s)
+static int on_resolved(sd_event_source *s, int fd, uint32_t revents, void *userdata)
 {
-	char *f[12];
+	struct source *src = userdata;
+	uint64_t count;
+	ssize_t len;
+	int rc;
 
-	return nmea_split(s, f, (int)(sizeof f / sizeof *f))
-		&& *f[1] == 'A'
-		&&  nmea_set(f[0], f[2], f[3], f[4], f[5], NULL, NULL, f[6], f[7], f[8]);
+	/* EAGAIN means a spurious wake up, the state being checked anyway */
+	do {
+		len = read(fd, &count, sizeof count);
+	} while (len < 0 && errno == EINTR);
+	if (len < 0 && errno != EAGAIN)
+		ERROR(afbitf, "can't read the eventfd of %s: %m", src->name);
+	if (src->state != state_resolving)
+		return 0;
+	rc = gai_error(&src->gai);
+	if (rc == EAI_INPROGRESS)
+		return 0;
+	if (rc != 0)
+		connect_retry(src, gai_strerror(rc));
+	else {
+		src->addr = src->gai.ar_result;
+		src->error = NULL;
+		connect_next(src);
+	}
+	return 0;
 }
 
-
 /*
- * interprete one NMEA sentence
+ * opens the serial device of the source, in raw mode at its speed
+ *
+ * The reads being non-blocking from the event loop, VTIME can't help
+ * and VMIN is 1: the readiness of a tty waiting VMIN bytes without
+ * VTIME would delay the end of each burst of sentences until the next
+ * one. A burst is read in place in the ring at once by nmea_read.
  */
-static int nmea_sentence(char *s)
+static void connect_tty(struct source *src)
 {
-	if (!s[0] || !s[1])
-		return 0;
+	int fd, rc;
+	struct termios tio;
 
-	if (s[2] == 'G' && s[3] == 'G' && s[4] == 'A' && s[5] == ',')
-		return nmea_gga(&s[6]);
+	fd = open(src->host, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		connect_retry(src, strerror(errno));
+		return;
+	}
+	if (tcgetattr(fd, &tio) < 0)
+		goto error;
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	if (cfsetspeed(&tio, src->speed) < 0 || tcsetattr(fd, TCSANOW, &tio) < 0)
+		goto error;
+	tcflush(fd, TCIFLUSH);
 
-	if (s[2] == 'R' && s[3] == 'M' && s[4] == 'C' && s[5] == ',')
-		return nmea_rmc(&s[6]);
+	rc = sd_event_add_io(afb_daemon_get_event_loop(afbitf->daemon), &src->evsrc, fd, EPOLLIN, on_event, src);
+	if (rc < 0) {
+		src->evsrc = NULL;
+		close(fd);
+		connect_retry(src, strerror(-rc));
+		return;
+	}
+	connected(src);
+	return;
 
-	return 0;
+error:
+	rc = errno;
+	close(fd);
+	connect_retry(src, strerror(rc));
 }
 
 /*
- * reads the NMEA stream
+ * starts the connection of the source to its nmea stream
+ *
+ * the resolution of the host and the service and the connection don't
+ * block: their completion is handled in the event loop and failures are
+ * retried after an exponential backoff
  */
-static int nmea_read(int fd)
+static int connect_to(struct source *src)
 {
-	static char buffer[160];
-	static int pos = 0;
-	static int overflow = 0;
-
 	int rc;
+	struct sigevent sev;
+	struct gaicb *list[1];
 
-	for(;;) {
-		rc = (int)read(fd, &buffer[pos], sizeof buffer - (size_t)pos);
+	if (src->state != state_idle && src->state != state_waiting)
+		return 0;
+
+	/* no resolution for devices and Unix domain sockets */
+	switch (src->kind) {
+	case kind_tty:
+		connect_tty(src);
+		return 0;
+	case kind_unix:
+		src->addr = &src->sunai;
+		src->error = NULL;
+		connect_next(src);
+		return 0;
+	default:
+		break;
+	}
+
+	/* the eventfd signaling the end of the resolution */
+	if (src->efdsrc == NULL) {
+		src->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (src->efd < 0) {
+			ERROR(afbitf, "can't create the eventfd of %s: %m", src->name);
+			return -1;
+		}
+		rc = sd_event_add_io(afb_daemon_get_event_loop(afbitf->daemon), &src->efdsrc, src->efd, EPOLLIN, on_resolved, src);
 		if (rc < 0) {
-			/* its an error if not interrupted */
-			if (errno != EINTR)
-				return rc;
-		} else if (rc == 0) {
-			/* nothing more to be read */
-			return 0;
-		} else {
-			/* scan the buffer */
-			while (pos != rc) {
-				if (buffer[pos] != '\n') {
-					pos++;
-					if (pos == rc) {
-						if (pos == (int)(sizeof buffer)) {
-							overflow = 1;
-							pos = 0;
-							rc = 0;
-						}
-					}
-				} else {
-					if (buffer[0] == '$' && pos > 0 && buffer[pos-1] == '\r' && !overflow) {
-						if (pos > 3 && buffer[pos-4] == '*') {
-							/* TODO: check the cheksum */
-							buffer[pos-4] = 0;
-						} else {
-							buffer[pos-1] = 0;
-						}
-						nmea_sentence(&buffer[1]);
-					}
-					pos++;
-					rc -= pos;
-					if (rc > 0)
-						memmove(buffer, buffer+pos, (size_t)rc);
-					pos = 0;
-					overflow = 0;
-				}
-			}
+			close(src->efd);
+			src->efdsrc = NULL;
+			ERROR(afbitf, "can't add the eventfd of %s to the event loop: %s", src->name, strerror(-rc));
+			return rc;
 		}
 	}
+
+	/* starts the resolution */
+	memset(&src->hint, 0, sizeof src->hint);
+	src->hint.ai_family = AF_UNSPEC;
+	src->hint.ai_socktype = SOCK_STREAM;
+	memset(&src->gai, 0, sizeof src->gai);
+	src->gai.ar_name = src->host;
+	src->gai.ar_service = src->service;
+	src->gai.ar_request = &src->hint;
+	memset(&sev, 0, sizeof sev);
+	sev.sigev_notify = SIGEV_THREAD;
+	sev.sigev_notify_function = on_resolved_thread;
+	sev.sigev_value.sival_ptr = src;
+	list[0] = &src->gai;
+	src->state = state_resolving;
+	rc = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+	if (rc != 0)
+		connect_retry(src, gai_strerror(rc));
+	return 0;
 }
 
-/***************************************************************************************/
-/***************************************************************************************/
-/**                                                                                   **/
-/**                                                                                   **/
-/**       SECTION: HANDLING OF CONNECTION                                             **/
-/**                                                                                   **/
-/**                                                                                   **/
-/***************************************************************************************/
-/***************************************************************************************/
-/* declare the connection routine */
-static int connection();
+/*
+ * returns the speed of 'bauds' or B0 if not supported
+ */
+static speed_t speed_of_bauds(long bauds)
+{
+	switch (bauds) {
+	case 1200: return B1200;
+	case 2400: return B2400;
+	case 4800: return B4800;
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	default: return B0;
+	}
+}
 
 /*
- * called on an event on the NMEA stream
+ * creates the source of 'name' for the 'uri' that is one of:
+ *
+ *   gpsd://HOST:SERVICE     a gpsd server over TCP
+ *   nmea://HOST:SERVICE     a raw NMEA stream over TCP
+ *   unix://PATH             a gpsd server on a Unix domain socket
+ *   gpsd+json://HOST:SERVICE, unix+json://PATH
+ *                           a gpsd server sending its JSON reports
+ *   tty://DEVICE[:BAUDS]    a raw NMEA stream of a serial device
+ *                           (at 4800 bauds if not given)
  */
-static int on_event(sd_event_source *s, int fd, uint32_t revents, void *userdata)
+static struct source *source_create(const char *name, const char *uri, uint32_t history_size)
 {
-	/* read available data */
-	if ((revents & EPOLLIN) != 0) {
-		nmea_read(fd);
-		event_send();
+	struct source *src, **prv;
+	const char *path, *colon, *service;
+	char *end, bauds_text[12];
+	int isgpsd, isjson = 0;
+	enum kind kind;
+	long bauds;
+	speed_t speed = B0;
+
+	/* parse the uri */
+	path = &uri[7];
+	if (!strncmp(uri, "gpsd://", 7)) {
+		isgpsd = 1;
+		kind = kind_tcp;
+	} else if (!strncmp(uri, "nmea://", 7)) {
+		isgpsd = 0;
+		kind = kind_tcp;
+	} else if (!strncmp(uri, "unix://", 7)) {
+		isgpsd = 1;
+		kind = kind_unix;
+	} else if (!strncmp(uri, "gpsd+json://", 12)) {
+		isgpsd = isjson = 1;
+		kind = kind_tcp;
+		path = &uri[12];
+	} else if (!strncmp(uri, "unix+json://", 12)) {
+		isgpsd = isjson = 1;
+		kind = kind_unix;
+		path = &uri[12];
+	} else if (!strncmp(uri, "tty://", 6)) {
+		isgpsd = 0;
+		kind = kind_tty;
+		path = &uri[6];
+	} else {
+		ERROR(afbitf, "unsupported uri %s for source %s", uri, name);
+		return NULL;
+	}
+	colon = strrchr(path, ':');
+	service = colon == NULL ? "" : &colon[1];
+	switch (kind) {
+	case kind_tcp:
+		if (colon == NULL || colon == path || !colon[1]) {
+			ERROR(afbitf, "bad host and service in uri %s for source %s", uri, name);
+			return NULL;
+		}
+		break;
+	case kind_unix:
+		colon = &path[strlen(path)];
+		service = "";
+		if (colon == path || colon - path >= (long)sizeof src->sun.sun_path) {
+			ERROR(afbitf, "bad path in uri %s for source %s", uri, name);
+			return NULL;
+		}
+		break;
+	case kind_tty:
+		if (colon == NULL)
+			colon = &path[strlen(path)];
+		bauds = *colon ? strtol(&colon[1], &end, 10) : DEFAULT_BAUDS;
+		speed = speed_of_bauds(bauds);
+		if (colon == path || speed == B0 || (*colon && *end)) {
+			ERROR(afbitf, "bad device or speed in uri %s for source %s", uri, name);
+			return NULL;
+		}
+		snprintf(bauds_text, sizeof bauds_text, "%ld", bauds);
+		service = bauds_text;
+		break;
 	}
 
-	/* check if error or hangup */
-	if ((revents & (EPOLLERR|EPOLLRDHUP|EPOLLHUP)) != 0) {
-		sd_event_source_unref(s);
-		close(fd);
-		connection(fd);
+	/* allocates the source */
+	src = calloc(1, sizeof *src);
+	if (src == NULL)
+		goto error;
+	src->name = strdup(name);
+	src->host = strndup(path, (size_t)(colon - path));
+	src->service = strdup(service);
+	src->isgpsd = isgpsd;
+	src->isjson = isjson;
+	src->scan = isjson ? gpsd_scan : ring_scan;
+	src->kind = kind;
+	src->speed = speed;
+	src->backoff = RETRY_MIN;
+	src->recfd = -1;
+	src->stats = calloc(1, sizeof *src->stats);
+	if (src->name == NULL || src->host == NULL || src->service == NULL || src->stats == NULL)
+		goto error2;
+	if (kind == kind_unix) {
+		src->sun.sun_family = AF_UNIX;
+		strcpy(src->sun.sun_path, src->host);
+		src->sunai.ai_family = AF_UNIX;
+		src->sunai.ai_socktype = SOCK_STREAM;
+		src->sunai.ai_addr = (struct sockaddr*)&src->sun;
+		src->sunai.ai_addrlen = sizeof src->sun;
 	}
+	if (ring_init(&src->ring) < 0)
+		goto error2;
+	if (history_init(&src->history, history_size) < 0)
+		goto error2;
 
-	return 0;
+	/* append it to the list */
+	prv = &list_of_sources;
+	while (*prv != NULL)
+		prv = &(*prv)->next;
+	*prv = src;
+	return src;
+
+error2:
+	free(src->stats);
+	free((char*)src->name);
+	free(src->host);
+	free(src->service);
+	free(src);
+error:
+	ERROR(afbitf, "can't create the source %s: %m", name);
+	return NULL;
 }
 
 /*
- * opens a socket to a host and a service (or port)
+ * creates the sources from the environment
+ *
+ * AFBGPS_SOURCES is a list of sources separated by spaces.
+ * Each source is given as [NAME=]URI (see source_create). Sources
+ * without name are named GPS, GPS1, GPS2, ... according to their rank.
+ *
+ * Without AFBGPS_SOURCES, the single source GPS is created from
+ * AFBGPS_HOST, AFBGPS_SERVICE and AFBGPS_ISNMEA.
+ *
+ * AFBGPS_HISTORY is the count of fixes recorded by source.
  */
-static int open_socket_to(const char *host, const char *service)
+static int sources_init()
 {
-	int rc, fd;
-	struct addrinfo hint, *rai, *iai;
+	const char *list, *host, *service, *history;
+	char *copy, *item, *next, *eq, name[20], uri[300];
+	int rank, rc;
+	uint32_t size;
 
-	/* get addr */
-	memset(&hint, 0, sizeof hint);
-	hint.ai_family = AF_INET;
-	hint.ai_socktype = SOCK_STREAM;
-	rc = getaddrinfo(host, service, &hint, &rai);
-	if (rc != 0)
-		return -1;
+	history = getenv("AFBGPS_HISTORY");
+	size = history != NULL && atoi(history) > 0 ? (uint32_t)atoi(history) : HISTORY_SIZE;
 
-	/* get the socket */
-	iai = rai;
-	while (iai != NULL) {
-		fd = socket(iai->ai_family, iai->ai_socktype, iai->ai_protocol);
-		if (fd >= 0) {
-			rc = connect(fd, iai->ai_addr, iai->ai_addrlen);
-			if (rc == 0) {
-				fcntl(fd, F_SETFL, O_NONBLOCK);
-				freeaddrinfo(rai);
-				return fd;
-			}
-			close(fd);
+	list = getenv("AFBGPS_SOURCES");
+	if (list == NULL) {
+		host = getenv("AFBGPS_HOST") ? : "sinagot.net";
+		service = getenv("AFBGPS_SERVICE") ? : "5001";
+		rc = snprintf(uri, sizeof uri, "%s://%s:%s", getenv("AFBGPS_ISNMEA") ? "nmea" : "gpsd", host, service);
+		if (rc < 0 || rc >= (int)sizeof uri)
+			return -1;
+		return source_create("GPS", uri, size) == NULL ? -1 : 0;
+	}
+
+	copy = strdup(list);
+	if (copy == NULL)
+		return -1;
+	rc = 0;
+	rank = 0;
+	for (item = strtok_r(copy, " \t", &next) ; item != NULL && rc == 0 ; item = strtok_r(NULL, " \t", &next)) {
+		eq = strchr(item, '=');
+		if (eq != NULL) {
+			*eq = 0;
+			rc = source_create(item, &eq[1], size) == NULL ? -1 : 0;
+		} else {
+			snprintf(name, sizeof name, rank ? "GPS%d" : "GPS", rank);
+			rc = source_create(name, item, size) == NULL ? -1 : 0;
 		}
-		iai = iai->ai_next;
+		rank++;
 	}
-	freeaddrinfo(rai);
-	return -1;
+	free(copy);
+	return list_of_sources == NULL ? -1 : rc;
 }
 
 /*
- * connection to nmea stream for the host and the port
+ * reads the period of the statistics event from AFBGPS_STATS_PERIOD
  */
-static int connect_to(const char *host, const char *service, int isgpsd)
+static void stats_init()
 {
-	sd_event_source *source;
-	int rc, fd;
-
-	/* TODO connect to somewhere else */
-	fd = open_socket_to(host, service);
-	if (fd < 0) {
-		ERROR(afbitf, "can't connect to host %s, service %s", host, service);
-		return fd;
-	}
-	if (isgpsd) {
-		static const char gpsdsetup[] = "?WATCH={\"enable\":true,\"nmea\":true};\r\n";
-		write(fd, gpsdsetup, sizeof gpsdsetup - 1);
-	}
+	const char *text;
+	char *end;
+	long period;
 
-	/* adds to the event loop */
-	rc = sd_event_add_io(afb_daemon_get_event_loop(afbitf->daemon), &source, fd, EPOLLIN, on_event, NULL);
-	if (rc < 0) {
-		close(fd);
-		ERROR(afbitf, "can't coonect host %s, service %s to the event loop", host, service);
-	} else {
-		NOTICE(afbitf, "Connected to host %s, service %s", host, service);
+	text = getenv("AFBGPS_STATS_PERIOD");
+	if (text != NULL) {
+		period = strtol(text, &end, 10);
+		if (*end || period < MIN_PERIOD || period > MAX_PERIOD)
+			ERROR(afbitf, "bad AFBGPS_STATS_PERIOD %s", text);
+		else
+			stats_period = (uint32_t)period;
 	}
-	return rc;
 }
 
 /*
- * connection to nmea stream
+ * returns the source of 'name' or the first source if name is NULL
  */
-static int connection()
+static struct source *source_of_name(const char *name)
 {
-	const char *host;
-	const char *service;
-	int isgpsd;
+	struct source *src = list_of_sources;
 
-	/* TODO connect to somewhere else */
-	host = getenv("AFBGPS_HOST") ? : "sinagot.net";
-	service = getenv("AFBGPS_SERVICE") ? : "5001";
-	isgpsd = getenv("AFBGPS_ISNMEA") ? 0 : 1;
-	return connect_to(host, service, isgpsd);
+	if (name != NULL)
+		while (src != NULL && strcmp(src->name, name))
+			src = src->next;
+	return src;
 }
 
 /***************************************************************************************/
@@ -918,12 +3587,85 @@ static int get_type_for_req(struct afb_req req, enum type *type)
 	return 0;
 }
 
+/*
+ * extract a valid source from the request
+ */
+static int get_source_for_req(struct afb_req req, struct source **src)
+{
+	if ((*src = source_of_name(afb_req_value(req, "source"))) != NULL)
+		return 1;
+	afb_req_fail(req, "unknown-source", NULL);
+	return 0;
+}
+
+/*
+ * extract the value of the threshold 'name' from the request
+ */
+static int get_threshold_for_req(struct afb_req req, const char *name, double *value)
+{
+	const char *text;
+	char *end;
+
+	text = afb_req_value(req, name);
+	if (text == NULL) {
+		*value = 0;
+		return 1;
+	}
+	*value = strtod(text, &end);
+	if (end != text && !*end && *value >= 0)
+		return 1;
+	afb_req_fail_f(req, "bad-threshold", "invalid value of %s: %s", name, text);
+	return 0;
+}
+
+/*
+ * extract a valid period from the request: "fix" for every fix or
+ * milliseconds clamped from MIN_PERIOD to MAX_PERIOD (DEFAULT_PERIOD
+ * if absent), only the values that aren't numbers being rejected
+ */
+static int get_period_for_req(struct afb_req req, int *period)
+{
+	const char *text;
+	char *end;
+	long value;
+
+	text = afb_req_value(req, "period");
+	if (text == NULL) {
+		*period = DEFAULT_PERIOD;
+		return 1;
+	}
+	if (!strcmp(text, "fix")) {
+		*period = PERIOD_ON_FIX;
+		return 1;
+	}
+	value = strtol(text, &end, 10);
+	if (end != text && !*end) {
+		*period = value < MIN_PERIOD ? MIN_PERIOD
+			: value > MAX_PERIOD ? MAX_PERIOD
+			: (int)value;
+		return 1;
+	}
+	afb_req_fail_f(req, "bad-period", "invalid period: %s", text);
+	return 0;
+}
+
+/*
+ * extract valid thresholds from the request
+ */
+static int get_thresholds_for_req(struct afb_req req, struct thresholds *min)
+{
+	return get_threshold_for_req(req, "distance", &min->distance)
+		&& get_threshold_for_req(req, "heading", &min->heading)
+		&& get_threshold_for_req(req, "speed", &min->speed);
+}
+
 /*
  * Get the last known position
  *
  * parameter of the get are:
  *
  *    type:   string: the type of position expected (defaults to "WGS84" if not present)
+ *    source: string: the name of the source (defaults to the first source if not present)
  *
  * returns the position
  *
@@ -940,12 +3682,27 @@ static int get_type_for_req(struct afb_req req, enum type *type)
  *  +----------+                       +-------+          |       |
  *  | DMS.kn   |                       |  kn   |          |       |
  *  +==========+=======================+=======+==========+=======+
+ *
+ * The type BINARY returns an object with the fields 'type' and 'data',
+ * data being the base64 encoding of a packed binary record of fixed
+ * size whose layout is described by new_binary.
+ *
+ * When known, the position also contains the fields:
+ *
+ *    date:               string:  the date as YYYY-MM-DD
+ *    fix:                integer: the fix mode: 1 none, 2 2D, 3 3D
+ *    satellites:         integer: count of satellites used for the fix
+ *    satellites-in-view: integer: count of satellites in view
+ *    pdop, hdop, vdop:   double:  position, horizontal and vertical dilution of precision
+ *    accuracy:           double:  horizontal error in meters (gpsd JSON sources only)
+ *    altitude-accuracy:  double:  vertical error in meters (gpsd JSON sources only)
  */
 static void get(struct afb_req req)
 {
 	enum type type;
-	if (get_type_for_req(req, &type))
-		afb_req_success(req, position(type), NULL);
+	struct source *src;
+	if (get_source_for_req(req, &src) && get_type_for_req(req, &type))
+		afb_req_success(req, position(src, type), NULL);
 }
 
 /*
@@ -956,22 +3713,35 @@ static void get(struct afb_req req)
  *    type:   string:  the type of position expected (defaults to WCS84 if not present)
  *                     see the list above (get)
  *    period: integer: the expected period in milliseconds (defaults to 2000 if not present)
+ *                     clamped from 10 to 60000, or "fix" for an event on every fix
+ *    source: string:  the name of the source (defaults to the first source if not present)
+ *
+ * optional thresholds of the subscription, the position being sent
+ * only when one of them is reached since the position last sent:
+ *
+ *    distance: double: the minimal move in meters
+ *    heading:  double: the minimal change of the track in degrees
+ *    speed:    double: the minimal change of the speed in m/s
+ *
+ * the position is anyway sent at least every minute.
  *
  * returns an object with 2 fields:
  *
- *    name:   string:  the name of the event without its prefix
+ *    name:   string:  the name of the event without its prefix, the name of the source
  *    id:     integer: a numeric identifier of the event to be used for unsubscribing
  */
 static void subscribe(struct afb_req req)
 {
 	enum type type;
-	const char *period;
+	int period;
+	struct thresholds min;
+	struct source *src;
 	struct event *event;
 	struct json_object *json;
 
-	if (get_type_for_req(req, &type)) {
-		period = afb_req_value(req, "period");
-		event = event_get(type, period == NULL ? DEFAULT_PERIOD : atoi(period));
+	if (get_source_for_req(req, &src) && get_type_for_req(req, &type)
+	 && get_period_for_req(req, &period) && get_thresholds_for_req(req, &min)) {
+		event = event_get(src, type, period, &min);
 		if (event == NULL)
 			afb_req_fail(req, "out-of-memory", NULL);
 		else if (afb_req_subscribe(req, event->event) != 0)
@@ -1011,6 +3781,300 @@ static void unsubscribe(struct afb_req req)
 	}
 }
 
+/*
+ * Get the last fixes of a source
+ *
+ * parameters of the history are:
+ *
+ *    type:   string:  the type of positions expected (defaults to WCS84 if not present)
+ *    source: string:  the name of the source (defaults to the first source if not present)
+ *    count:  integer: the count of fixes expected (defaults to 10 if not present)
+ *                     it is bounded by the size of the history (see AFBGPS_HISTORY)
+ *
+ * returns an array of positions as returned by get, from the oldest
+ * to the newest, the last one being the current fix
+ */
+static void history(struct afb_req req)
+{
+	enum type type;
+	const char *count;
+	struct source *src;
+	struct history *h;
+	struct json_object *json, *item;
+	struct cache cache;
+	struct gps gps;
+	uint32_t n, index, end;
+
+	if (get_source_for_req(req, &src) && get_type_for_req(req, &type)) {
+		h = &src->history;
+		count = afb_req_value(req, "count");
+		n = count == NULL ? HISTORY_COUNT : atoi(count) > 0 ? (uint32_t)atoi(count) : 0;
+		if (n > h->mask + 1)
+			n = h->mask + 1;
+		end = history_count(h);
+		if (n > end)
+			n = end;
+
+		json = json_object_new_array();
+		memset(&cache, 0, sizeof cache);
+		for (index = end - n ; index != end ; index++) {
+			if (history_read(h, index, &gps)) {
+				item = new_position(&cache, &gps, type);
+				if (item != NULL)
+					json_object_array_add(json, item);
+				cache_clear(&cache);
+			}
+		}
+		afb_req_success(req, json, NULL);
+	}
+}
+
+/*
+ * returns the statistics of the source as a JSON object
+ */
+static struct json_object *source_stats(struct source *src)
+{
+	struct json_object *json;
+
+	json = json_object_new_object();
+	json_object_object_add(json, "sentences", json_object_new_int64((int64_t)src->ring.sentences));
+	json_object_object_add(json, "checksum-errors", json_object_new_int64((int64_t)src->ring.checksum_errors));
+	json_object_object_add(json, "too-long", json_object_new_int64((int64_t)src->ring.too_long));
+	json_object_object_add(json, "malformed", json_object_new_int64((int64_t)src->ring.malformed));
+	json_object_object_add(json, "renders", json_object_new_int64((int64_t)src->renders));
+	json_object_object_add(json, "reads", json_object_new_int64((int64_t)src->stats->reads));
+	json_object_object_add(json, "bytes", json_object_new_int64((int64_t)src->stats->bytes));
+	json_object_object_add(json, "pushes", json_object_new_int64((int64_t)src->stats->pushes));
+	json_object_object_add(json, "drops", json_object_new_int64((int64_t)src->stats->drops));
+	json_object_object_add(json, "read-bytes", histo_stats(&src->stats->read));
+	json_object_object_add(json, "scan-ns", histo_stats(&src->stats->scan));
+	json_object_object_add(json, "send-ns", histo_stats(&src->stats->send));
+	return json;
+}
+
+/*
+ * pushes the statistics of all the sources periodically, stopping
+ * when no client listens them anymore
+ */
+static int on_stats_timer(sd_event_source *s, uint64_t usec, void *userdata)
+{
+	struct json_object *json;
+	struct source *src;
+
+	json = json_object_new_object();
+	for (src = list_of_sources ; src != NULL ; src = src->next)
+		json_object_object_add(json, src->name, source_stats(src));
+	if (afb_event_push(stats_event, json) == 0)
+		stats_running = 0;
+	else {
+		sd_event_source_set_time(stats_timer, usec + (uint64_t)stats_period * 1000);
+		sd_event_source_set_enabled(stats_timer, SD_EVENT_ONESHOT);
+	}
+	return 0;
+}
+
+/*
+ * subscribes the client of 'req' to the periodic statistics
+ */
+static int stats_subscribe(struct afb_req req)
+{
+	int rc;
+
+	if (stats_event.itf == NULL) {
+		stats_event = afb_daemon_make_event(afbitf->daemon, "stats");
+		if (stats_event.itf == NULL)
+			return -1;
+	}
+	if (afb_req_subscribe(req, stats_event) != 0)
+		return -1;
+	if (stats_timer == NULL) {
+		rc = sd_event_add_time(afb_daemon_get_event_loop(afbitf->daemon), &stats_timer,
+				CLOCK_MONOTONIC, now_us() + (uint64_t)stats_period * 1000,
+				TIMER_ACCURACY, on_stats_timer, NULL);
+		if (rc < 0) {
+			stats_timer = NULL;
+			errno = -rc;
+			return -1;
+		}
+	} else if (!stats_running) {
+		sd_event_source_set_time(stats_timer, now_us() + (uint64_t)stats_period * 1000);
+		sd_event_source_set_enabled(stats_timer, SD_EVENT_ONESHOT);
+	}
+	stats_running = 1;
+	return 0;
+}
+
+/*
+ * Get the statistics of the stream of a source
+ *
+ * The counters and histograms are updated on the hot paths by the
+ * thread of the event loop, the only one reading and sending.
+ *
+ * parameter of the stats are:
+ *
+ *    source: string: the name of the source (defaults to the first source if not present)
+ *    event:  string: "subscribe" or "unsubscribe" to the event 'stats' pushing
+ *                    periodically the statistics of all the sources by name,
+ *                    available when AFBGPS_STATS_PERIOD gives its period in ms
+ *
+ * returns an object with the fields:
+ *
+ *    sentences:        integer: count of sentences or gpsd reports accepted
+ *    checksum-errors:  integer: count of sentences rejected for bad checksum
+ *    too-long:         integer: count of sentences rejected as longer than 160 bytes
+ *    malformed:        integer: count of gpsd reports rejected as malformed
+ *    renders:          integer: count of positions rendered to JSON strings
+ *    reads:            integer: count of reads of the stream
+ *    bytes:            integer: count of bytes read
+ *    pushes:           integer: count of events pushed
+ *    drops:            integer: count of events dropped for having no listener
+ *    read-bytes:       object:  histogram of the bytes got by read
+ *    scan-ns:          object:  histogram of the time of scan of the bytes read
+ *    send-ns:          object:  histogram of the time of sending the events of a period
+ *    pools:            object:  for the pools of periods, events and renders,
+ *                               the counts of nodes live and free and of slabs
+ *
+ * the histograms are summarized by the integers count, mean, p50, p90,
+ * p99, p999 and max, within 3% of the exact values
+ */
+static void stats(struct afb_req req)
+{
+	struct source *src;
+	struct json_object *json, *pools;
+	const char *event;
+
+	if (get_source_for_req(req, &src)) {
+		event = afb_req_value(req, "event");
+		if (event != NULL) {
+			if (stats_period == 0) {
+				afb_req_fail(req, "disabled", "AFBGPS_STATS_PERIOD isn't set");
+				return;
+			}
+			if (!strcmp(event, "unsubscribe")) {
+				if (stats_event.itf != NULL)
+					afb_req_unsubscribe(req, stats_event);
+			} else if (strcmp(event, "subscribe")) {
+				afb_req_fail(req, "bad-event", NULL);
+				return;
+			} else if (stats_subscribe(req) < 0) {
+				afb_req_fail_f(req, "failed", "can't subscribe to statistics: %m");
+				return;
+			}
+		}
+		json = source_stats(src);
+		pools = json_object_new_object();
+		json_object_object_add(pools, "periods", pool_stats(&period_pool));
+		json_object_object_add(pools, "events", pool_stats(&event_pool));
+		json_object_object_add(pools, "renders", pool_stats(&render_pool));
+		json_object_object_add(json, "pools", pools);
+		afb_req_success(req, json, NULL);
+	}
+}
+
+/*
+ * Get the status of the connection of a source
+ *
+ * parameter of the status is:
+ *
+ *    source: string: the name of the source (defaults to the first source if not present)
+ *
+ * returns an object with the fields:
+ *
+ *    state:       string:  idle, resolving, connecting, connected or waiting
+ *    connections: integer: count of successful connections
+ *    failures:    integer: count of failed attempts and of hangups
+ *    error:       string:  the last error, if any
+ *    retry:       integer: the delay in ms before the next attempt when waiting
+ */
+static void status(struct afb_req req)
+{
+	struct source *src;
+	struct json_object *json;
+	uint64_t now;
+
+	if (get_source_for_req(req, &src)) {
+		json = json_object_new_object();
+		json_object_object_add(json, "state", json_object_new_string(state_NAMES[src->state]));
+		json_object_object_add(json, "connections", json_object_new_int64((int64_t)src->connections));
+		json_object_object_add(json, "failures", json_object_new_int64((int64_t)src->failures));
+		if (src->error != NULL)
+			json_object_object_add(json, "error", json_object_new_string(src->error));
+		if (src->state == state_waiting) {
+			now = now_us();
+			json_object_object_add(json, "retry", json_object_new_int64(src->due > now ? (int64_t)(src->due - now) / 1000 : 0));
+		}
+		afb_req_success(req, json, NULL);
+	}
+}
+
+/*
+ * Record the stream of a source
+ *
+ * The recordings are made in the directory given by AFBGPS_RECORD_DIR,
+ * recording being disabled when it isn't set.
+ *
+ * parameters of the record are:
+ *
+ *    source: string: the name of the source (defaults to the first source if not present)
+ *    file:   string: the name of the file of the recording in the directory
+ *                    starts the recording if present, stops it otherwise
+ */
+static void record(struct afb_req req)
+{
+	struct source *src;
+	const char *dir, *file;
+	char path[PATH_MAX];
+	int rc;
+
+	if (get_source_for_req(req, &src)) {
+		dir = getenv("AFBGPS_RECORD_DIR");
+		file = afb_req_value(req, "file");
+		if (dir == NULL)
+			afb_req_fail(req, "disabled", "AFBGPS_RECORD_DIR isn't set");
+		else if (file == NULL) {
+			record_stop(src);
+			afb_req_success(req, NULL, NULL);
+		} else if (!*file || file[0] == '.' || strchr(file, '/') != NULL)
+			afb_req_fail(req, "bad-file", NULL);
+		else {
+			rc = snprintf(path, sizeof path, "%s/%s", dir, file);
+			if (rc < 0 || rc >= (int)sizeof path)
+				afb_req_fail(req, "bad-file", NULL);
+			else if (record_start(src, path) < 0)
+				afb_req_fail_f(req, "failed", "can't record in %s: %m", path);
+			else
+				afb_req_success(req, NULL, NULL);
+		}
+	}
+}
+
+/*
+ * List the sources
+ *
+ * returns an array of objects with the fields:
+ *
+ *    name:      string:  the name of the source
+ *    host:      string:  the host of the source, or the path of its socket or device
+ *    service:   string:  the service of the source, or the speed of its device
+ *    connected: boolean: is the source connected?
+ */
+static void sources(struct afb_req req)
+{
+	struct source *src;
+	struct json_object *json, *item;
+
+	json = json_object_new_array();
+	for (src = list_of_sources ; src != NULL ; src = src->next) {
+		item = json_object_new_object();
+		json_object_object_add(item, "name", json_object_new_string(src->name));
+		json_object_object_add(item, "host", json_object_new_string(src->host));
+		json_object_object_add(item, "service", json_object_new_string(src->service));
+		json_object_object_add(item, "connected", json_object_new_boolean(src->state == state_connected));
+		json_object_array_add(json, item);
+	}
+	afb_req_success(req, json, NULL);
+}
+
 /*
  * array of the verbs exported to afb-daemon
  */
@@ -1019,6 +4083,11 @@ static const struct afb_verb_desc_v1 binding_verbs[] = {
   { .name= "get",          .session= AFB_SESSION_NONE, .callback= get,          .info= "get the last known data" },
   { .name= "subscribe",    .session= AFB_SESSION_NONE, .callback= subscribe,    .info= "subscribe to notification of position" },
   { .name= "unsubscribe",  .session= AFB_SESSION_NONE, .callback= unsubscribe,  .info= "unsubscribe a previous subscription" },
+  { .name= "history",      .session= AFB_SESSION_NONE, .callback= history,      .info= "get the last fixes" },
+  { .name= "stats",        .session= AFB_SESSION_NONE, .callback= stats,        .info= "get statistics of the stream of a source" },
+  { .name= "status",       .session= AFB_SESSION_NONE, .callback= status,       .info= "get the status of the connection of a source" },
+  { .name= "record",       .session= AFB_SESSION_NONE, .callback= record,       .info= "start or stop the recording of a source" },
+  { .name= "sources",      .session= AFB_SESSION_NONE, .callback= sources,      .info= "list the sources of GPS data" },
   { .name= NULL } /* marker for end of the array */
 };
 
@@ -1047,5 +4116,18 @@ const struct afb_binding *afbBindingV1Register(const struct afb_binding_interfac
 
 int afbBindingV1ServiceInit(struct afb_service service)
 {
-	return connection();
+	struct source *src;
+	int rc;
+
+	nmea_scan_init();
+	if (sources_init() < 0)
+		return -1;
+	stats_init();
+
+	/* succeeds if the connection of at least one source is started */
+	rc = -1;
+	for (src = list_of_sources ; src != NULL ; src = src->next)
+		if (connect_to(src) >= 0)
+			rc = 0;
+	return rc;
 }
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Format of the recordings of the streams of the GPS binding
+ *
+ * A recording starts with the 8 bytes of GPS_RECORD_MAGIC and is
+ * followed by the chunks of bytes in the order they were read.
+ * Each chunk starts with a header of GPS_RECORD_HEADER bytes:
+ *
+ *  +========+======+=======================================================+
+ *  | offset | type | value                                                 |
+ *  +========+======+=======================================================+
+ *  |      0 | u64  | time of the read in us since the start of recording   |
+ *  |      8 | u32  | length of the chunk in bytes                          |
+ *  +========+======+=======================================================+
+ *
+ * All the values are little endian.
+ */
+
+#define GPS_RECORD_MAGIC	"AFBGPSR1"
+#define GPS_RECORD_MAGIC_LENGTH	8
+#define GPS_RECORD_HEADER	12
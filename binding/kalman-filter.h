@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Kalman filter of angles fusing accelerometer angles and gyroscope rates
+ *
+ * Each axis is a filter of 2 states, the angle and the bias of the
+ * gyroscope, whose covariance is the 2x2 matrix P:
+ *
+ *   predict:  angle += dt * (rate - bias)
+ *             P00 += dt * (Q_angle - (P01 + P10))   (dt * dt * P11 neglected)
+ *             P01 -= dt * P11
+ *             P10 -= dt * P11
+ *             P11 += dt * Q_gyro
+ *   update:   y = accangle - angle
+ *             S = P00 + R_angle
+ *             K0 = P00 / S, K1 = P10 / S
+ *             angle += K0 * y, bias += K1 * y
+ *             P00 -= K0 * P00, P01 -= K0 * P01
+ *             P10 -= K1 * P00, P11 -= K1 * P01   (P00 and P01 before update)
+ *
+ * The KALMAN_AXIS axis (X, Y, Z and yaw) are stored as structure of
+ * arrays so that one pass updates all of them in the lanes of one SSE
+ * or NEON register, or in a loop the compiler vectorizes.
+ *
+ * The batches of filters (struct kalman_batch) apply the same update to
+ * many independent filters stored as structure of arrays, by groups of
+ * KALMAN_LANES filters. When compiled with OpenMP, the groups of big
+ * batches are spread over the threads.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define KALMAN_LANES	4	/* count of filters updated at once */
+#define KALMAN_AXIS	KALMAN_LANES	/* count of axis filtered at once */
+#define KALMAN_OMP_MIN	4096	/* minimal count of filters of a batch run in parallel */
+#define KALMAN_X	0
+#define KALMAN_Y	1
+#define KALMAN_Z	2
+#define KALMAN_YAW	3
+
+/*
+ * state of the filters of the axis
+ */
+struct kalman {
+	float angle[KALMAN_AXIS] __attribute__((aligned(16)));	/* the filtered angles */
+	float bias[KALMAN_AXIS] __attribute__((aligned(16)));	/* the biases of the gyroscope */
+	float p00[KALMAN_AXIS] __attribute__((aligned(16)));	/* the covariances */
+	float p01[KALMAN_AXIS] __attribute__((aligned(16)));
+	float p10[KALMAN_AXIS] __attribute__((aligned(16)));
+	float p11[KALMAN_AXIS] __attribute__((aligned(16)));
+	float q_angle;		/* process noise of the angle */
+	float q_gyro;		/* process noise of the bias */
+	float r_angle;		/* measurement noise of the accelerometer angle */
+};
+
+/*
+ * state of a batch of filters
+ *
+ * the arrays are aligned and padded to a multiple of KALMAN_LANES
+ */
+struct kalman_batch {
+	int count;		/* count of filters */
+	float *angle;		/* the filtered angles */
+	float *bias;		/* the biases of the gyroscope */
+	float *p00;		/* the covariances */
+	float *p01;
+	float *p10;
+	float *p11;
+	float q_angle;		/* process noise of the angle */
+	float q_gyro;		/* process noise of the bias */
+	float r_angle;		/* measurement noise of the accelerometer angle */
+};
+
+/*
+ * initialises the filters with the noises given
+ */
+static inline void kalman_init(struct kalman *k, float q_angle, float q_gyro, float r_angle)
+{
+	int i;
+
+	for (i = 0 ; i < KALMAN_AXIS ; i++)
+		k->angle[i] = k->bias[i] = k->p00[i] = k->p01[i] = k->p10[i] = k->p11[i] = 0;
+	k->q_angle = q_angle;
+	k->q_gyro = q_gyro;
+	k->r_angle = r_angle;
+}
+
+/*
+ * updates the filter of index 'i' of the arrays
+ */
+static inline void kalman_update_1(float *k_angle, float *k_bias, float *k_p00, float *k_p01,
+		float *k_p10, float *k_p11, const float *accangle, const float *rate,
+		float dt, float q_angle, float q_gyro, float r_angle, int i)
+{
+	float angle, p00, p01, p10, p11, y, s, k0, k1;
+
+	/* predict */
+	angle = k_angle[i] + dt * (rate[i] - k_bias[i]);
+	p00 = k_p00[i] + dt * (q_angle - (k_p01[i] + k_p10[i]));
+	p01 = k_p01[i] - dt * k_p11[i];
+	p10 = k_p10[i] - dt * k_p11[i];
+	p11 = k_p11[i] + dt * q_gyro;
+
+	/* update */
+	y = accangle[i] - angle;
+	s = p00 + r_angle;
+	k0 = p00 / s;
+	k1 = p10 / s;
+	k_angle[i] = angle + k0 * y;
+	k_bias[i] += k1 * y;
+	k_p00[i] = p00 - k0 * p00;
+	k_p01[i] = p01 - k0 * p01;
+	k_p10[i] = p10 - k1 * p00;
+	k_p11[i] = p11 - k1 * p01;
+}
+
+/*
+ * updates the KALMAN_LANES filters starting at index 'i' of the arrays,
+ * 'i' being a multiple of KALMAN_LANES for the arrays of state, aligned
+ * on 16 bytes
+ */
+static inline void kalman_update_lanes(float *k_angle, float *k_bias, float *k_p00, float *k_p01,
+		float *k_p10, float *k_p11, const float *accangle, const float *rate,
+		float dt, float q_angle, float q_gyro, float r_angle, int i)
+{
+#if defined(__SSE__)
+	__m128 vdt = _mm_set1_ps(dt);
+	__m128 angle = _mm_load_ps(&k_angle[i]), bias = _mm_load_ps(&k_bias[i]);
+	__m128 p00 = _mm_load_ps(&k_p00[i]), p01 = _mm_load_ps(&k_p01[i]);
+	__m128 p10 = _mm_load_ps(&k_p10[i]), p11 = _mm_load_ps(&k_p11[i]);
+	__m128 y, s, k0, k1;
+
+	/* predict */
+	angle = _mm_add_ps(angle, _mm_mul_ps(vdt, _mm_sub_ps(_mm_loadu_ps(&rate[i]), bias)));
+	p00 = _mm_add_ps(p00, _mm_mul_ps(vdt, _mm_sub_ps(_mm_set1_ps(q_angle), _mm_add_ps(p01, p10))));
+	p01 = _mm_sub_ps(p01, _mm_mul_ps(vdt, p11));
+	p10 = _mm_sub_ps(p10, _mm_mul_ps(vdt, p11));
+	p11 = _mm_add_ps(p11, _mm_mul_ps(vdt, _mm_set1_ps(q_gyro)));
+
+	/* update */
+	y = _mm_sub_ps(_mm_loadu_ps(&accangle[i]), angle);
+	s = _mm_add_ps(p00, _mm_set1_ps(r_angle));
+	k0 = _mm_div_ps(p00, s);
+	k1 = _mm_div_ps(p10, s);
+	_mm_store_ps(&k_angle[i], _mm_add_ps(angle, _mm_mul_ps(k0, y)));
+	_mm_store_ps(&k_bias[i], _mm_add_ps(bias, _mm_mul_ps(k1, y)));
+	_mm_store_ps(&k_p10[i], _mm_sub_ps(p10, _mm_mul_ps(k1, p00)));
+	_mm_store_ps(&k_p11[i], _mm_sub_ps(p11, _mm_mul_ps(k1, p01)));
+	_mm_store_ps(&k_p00[i], _mm_sub_ps(p00, _mm_mul_ps(k0, p00)));
+	_mm_store_ps(&k_p01[i], _mm_sub_ps(p01, _mm_mul_ps(k0, p01)));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	float32x4_t vdt = vdupq_n_f32(dt);
+	float32x4_t angle = vld1q_f32(&k_angle[i]), bias = vld1q_f32(&k_bias[i]);
+	float32x4_t p00 = vld1q_f32(&k_p00[i]), p01 = vld1q_f32(&k_p01[i]);
+	float32x4_t p10 = vld1q_f32(&k_p10[i]), p11 = vld1q_f32(&k_p11[i]);
+	float32x4_t y, s, inv, k0, k1;
+
+	/* predict */
+	angle = vmlaq_f32(angle, vdt, vsubq_f32(vld1q_f32(&rate[i]), bias));
+	p00 = vmlaq_f32(p00, vdt, vsubq_f32(vdupq_n_f32(q_angle), vaddq_f32(p01, p10)));
+	p01 = vmlsq_f32(p01, vdt, p11);
+	p10 = vmlsq_f32(p10, vdt, p11);
+	p11 = vmlaq_f32(p11, vdt, vdupq_n_f32(q_gyro));
+
+	/* update */
+	y = vsubq_f32(vld1q_f32(&accangle[i]), angle);
+	s = vaddq_f32(p00, vdupq_n_f32(r_angle));
+#if defined(__aarch64__)
+	inv = vdivq_f32(vdupq_n_f32(1), s);
+#else
+	inv = vrecpeq_f32(s);
+	inv = vmulq_f32(vrecpsq_f32(s, inv), inv);
+	inv = vmulq_f32(vrecpsq_f32(s, inv), inv);
+#endif
+	k0 = vmulq_f32(p00, inv);
+	k1 = vmulq_f32(p10, inv);
+	vst1q_f32(&k_angle[i], vmlaq_f32(angle, k0, y));
+	vst1q_f32(&k_bias[i], vmlaq_f32(bias, k1, y));
+	vst1q_f32(&k_p10[i], vmlsq_f32(p10, k1, p00));
+	vst1q_f32(&k_p11[i], vmlsq_f32(p11, k1, p01));
+	vst1q_f32(&k_p00[i], vmlsq_f32(p00, k0, p00));
+	vst1q_f32(&k_p01[i], vmlsq_f32(p01, k0, p01));
+#else
+	int j;
+
+	for (j = i ; j < i + KALMAN_LANES ; j++)
+		kalman_update_1(k_angle, k_bias, k_p00, k_p01, k_p10, k_p11,
+				accangle, rate, dt, q_angle, q_gyro, r_angle, j);
+#endif
+}
+
+/*
+ * updates the filters of all the axis for the elapsed time 'dt' in
+ * seconds with the angles measured by the accelerometer 'accangle' and
+ * the rates of the gyroscope 'rate', in degrees and degrees per second
+ *
+ * the filtered angles are in k->angle
+ */
+static inline void kalman_update(struct kalman *k, const float accangle[KALMAN_AXIS], const float rate[KALMAN_AXIS], float dt)
+{
+	kalman_update_lanes(k->angle, k->bias, k->p00, k->p01, k->p10, k->p11,
+			accangle, rate, dt, k->q_angle, k->q_gyro, k->r_angle, 0);
+}
+
+/*
+ * allocates the batch of 'count' filters and initialises them with
+ * the noises given
+ *
+ * returns 0 on success or -1 on error
+ */
+static inline int kalman_batch_init(struct kalman_batch *b, int count, float q_angle, float q_gyro, float r_angle)
+{
+	size_t size;
+	void *mem;
+
+	if (count <= 0)
+		return -1;
+	size = ((size_t)count + KALMAN_LANES - 1) / KALMAN_LANES * KALMAN_LANES * sizeof(float);
+	if (posix_memalign(&mem, 16, 6 * size) != 0)
+		return -1;
+	memset(mem, 0, 6 * size);
+	b->count = count;
+	b->angle = mem;
+	b->bias = (float*)((char*)mem + size);
+	b->p00 = (float*)((char*)mem + 2 * size);
+	b->p01 = (float*)((char*)mem + 3 * size);
+	b->p10 = (float*)((char*)mem + 4 * size);
+	b->p11 = (float*)((char*)mem + 5 * size);
+	b->q_angle = q_angle;
+	b->q_gyro = q_gyro;
+	b->r_angle = r_angle;
+	return 0;
+}
+
+/*
+ * releases the memory of the batch of filters
+ */
+static inline void kalman_batch_free(struct kalman_batch *b)
+{
+	free(b->angle);
+	b->angle = NULL;
+	b->count = 0;
+}
+
+/*
+ * updates all the filters of the batch for the elapsed time 'dt' in
+ * seconds with the arrays of b->count angles of the accelerometers
+ * 'accangle' and rates of the gyroscopes 'rate'
+ *
+ * the filtered angles are in b->angle
+ */
+static inline void kalman_batch_update(struct kalman_batch *b, const float *accangle, const float *rate, float dt)
+{
+	int i, n = b->count / KALMAN_LANES * KALMAN_LANES;
+
+#ifdef _OPENMP
+	/* a clause 'if' would still enter a serialized parallel region */
+	if (n >= KALMAN_OMP_MIN) {
+#pragma omp parallel for schedule(static)
+		for (i = 0 ; i < n ; i += KALMAN_LANES)
+			kalman_update_lanes(b->angle, b->bias, b->p00, b->p01, b->p10, b->p11,
+					accangle, rate, dt, b->q_angle, b->q_gyro, b->r_angle, i);
+	} else
+#endif
+	for (i = 0 ; i < n ; i += KALMAN_LANES)
+		kalman_update_lanes(b->angle, b->bias, b->p00, b->p01, b->p10, b->p11,
+				accangle, rate, dt, b->q_angle, b->q_gyro, b->r_angle, i);
+	for (i = n ; i < b->count ; i++)
+		kalman_update_1(b->angle, b->bias, b->p00, b->p01, b->p10, b->p11,
+				accangle, rate, dt, b->q_angle, b->q_gyro, b->r_angle, i);
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <time.h>
 #include "lsm9ds0.c"
+#include "kalman-filter.h"
 
 
 #define DT 0.02         // [s/loop] loop period. 20ms
@@ -43,18 +44,9 @@
 
 
 //Used by Kalman Filters
-float Q_angle  =  0.01;
-float Q_gyro   =  0.0003;
-float R_angle  =  0.01;
-float x_bias = 0;
-float y_bias = 0;
-float XP_00 = 0, XP_01 = 0, XP_10 = 0, XP_11 = 0;
-float YP_00 = 0, YP_01 = 0, YP_10 = 0, YP_11 = 0;
-float KFangleX = 0.0;
-float KFangleY = 0.0;
-
-float kalmanFilterX(float accAngle, float gyroRate);
-float kalmanFilterY(float accAngle, float gyroRate);
+#define Q_ANGLE 0.01
+#define Q_GYRO  0.0003
+#define R_ANGLE 0.01
 
 
 void  INThandler(int sig)
@@ -102,6 +94,12 @@ int main(int argc, char *argv[])
     int startInt  = mymillis();
     struct  timeval tvBegin, tvEnd,tvDiff;
 
+    struct kalman kalman;
+    float accAngles[KALMAN_AXIS] = { 0 };
+    float gyrRates[KALMAN_AXIS] = { 0 };
+
+    kalman_init(&kalman, Q_ANGLE, Q_GYRO, R_ANGLE);
+
 
         signal(SIGINT, INThandler);
 
@@ -162,9 +160,14 @@ int main(int argc, char *argv[])
 		else
 			AccYangle += (float)90;
 
-    //Kalman Filter
-    float kalmanX = kalmanFilterX(AccXangle, rate_gyr_x);
-    float kalmanY = kalmanFilterY(AccYangle, rate_gyr_y);
+    //Kalman Filter of X and Y in one pass
+    accAngles[KALMAN_X] = AccXangle;
+    accAngles[KALMAN_Y] = AccYangle;
+    gyrRates[KALMAN_X] = rate_gyr_x;
+    gyrRates[KALMAN_Y] = rate_gyr_y;
+    kalman_update(&kalman, accAngles, gyrRates, DT);
+    float kalmanX = kalman.angle[KALMAN_X];
+    float kalmanY = kalman.angle[KALMAN_Y];
     printf ("\033[22;31mkalmanX %7.3f  \033[22;36mkalmanY %7.3f\t\e[m",kalmanX,kalmanY);
 
     //Complementary filter used to combine the accelerometer and gyro values.
@@ -183,65 +186,3 @@ int main(int argc, char *argv[])
     printf("Loop Time %d\t", mymillis()- startInt);
     }
 }
-
-
-
-
-
-  float kalmanFilterX(float accAngle, float gyroRate)
-  {
-    float  y, S;
-    float K_0, K_1;
-
-
-    KFangleX += DT * (gyroRate - x_bias);
-
-    XP_00 +=  - DT * (XP_10 + XP_01) + Q_angle * DT;
-    XP_01 +=  - DT * XP_11;
-    XP_10 +=  - DT * XP_11;
-    XP_11 +=  + Q_gyro * DT;
-
-    y = accAngle - KFangleX;
-    S = XP_00 + R_angle;
-    K_0 = XP_00 / S;
-    K_1 = XP_10 / S;
-
-    KFangleX +=  K_0 * y;
-    x_bias  +=  K_1 * y;
-    XP_00 -= K_0 * XP_00;
-    XP_01 -= K_0 * XP_01;
-    XP_10 -= K_1 * XP_00;
-    XP_11 -= K_1 * XP_01;
-
-    return KFangleX;
-  }
-
-
-  float kalmanFilterY(float accAngle, float gyroRate)
-  {
-    float  y, S;
-    float K_0, K_1;
-
-
-    KFangleY += DT * (gyroRate - y_bias);
-
-    YP_00 +=  - DT * (YP_10 + YP_01) + Q_angle * DT;
-    YP_01 +=  - DT * YP_11;
-    YP_10 +=  - DT * YP_11;
-    YP_11 +=  + Q_gyro * DT;
-
-    y = accAngle - KFangleY;
-    S = YP_00 + R_angle;
-    K_0 = YP_00 / S;
-    K_1 = YP_10 / S;
-
-    KFangleY +=  K_0 * y;
-    y_bias  +=  K_1 * y;
-    YP_00 -= K_0 * YP_00;
-    YP_01 -= K_0 * YP_01;
-    YP_10 -= K_1 * YP_00;
-    YP_11 -= K_1 * YP_01;
-
-    return KFangleY;
-  }
-